@@ -0,0 +1,566 @@
+#include <Scattershot.hpp>
+#include <Utils.hpp>
+
+// Standalone micro-benchmarks for the bookkeeping layer (block index, merge and
+// segment GC). No emulator is loaded; block keys and segment trees are synthesized.
+// Usage: scattershot_bench [maxSharedBlocks] [maxSharedSegments] [threads]
+//        scattershot_bench -replay <trace prefix> [local blocks to compare spilling at]
+
+static volatile long long gSink;
+
+static int Probes(Vec3d pos, Block* blocks, int* hashTab, int maxHashes, int nMax)
+{
+    // Mirrors Vec3d::findBlock, but returns the number of slots visited.
+    uint64_t tmpSeed = pos.hashPos();
+    for (int i = 0; i < 100; i++) {
+        int blockInx = hashTab[tmpSeed % maxHashes];
+        if (blockInx == -1) return i + 1;
+        if (blockInx >= 0 && blockInx < nMax && pos.truncEq(blocks[blockInx].pos)) return i + 1;
+        Utils::xoro_r(&tmpSeed);
+    }
+    return 100;
+}
+
+// Bins are drawn from a random walk so that keys cluster the way a real search does:
+// a handful of actions, neighbouring spatial cubes and a few speed/yaw buckets.
+class BinGenerator
+{
+public:
+    uint64_t seed;
+    int x = 40, y = 10, z = 40;
+
+    BinGenerator(uint64_t seed) : seed(seed) { }
+
+    Vec3d Next()
+    {
+        x = (x + (int)(Utils::xoro_r(&seed) % 3) - 1 + 80) % 80;
+        z = (z + (int)(Utils::xoro_r(&seed) % 3) - 1 + 80) % 80;
+        y = (y + (int)(Utils::xoro_r(&seed) % 3) - 1 + 12) % 12;
+
+        uint64_t s = Utils::xoro_r(&seed) % 10;
+        s = s * 30 + Utils::xoro_r(&seed) % 30;
+        s = s * 200 + Utils::xoro_r(&seed) % 200;
+        s = s * 300 + Utils::xoro_r(&seed) % 60;
+        s += ((uint64_t)1200000000) * (Utils::xoro_r(&seed) % 16);
+        s *= 2;
+
+        return Vec3d{ (uint8_t)x, (uint8_t)y, (uint8_t)z, s };
+    }
+};
+
+static void InsertShared(Block* blocks, int* hashTab, int maxHashes, int& nBlocks, Block block)
+{
+    int m = block.pos.findBlock(blocks, hashTab, maxHashes, 0, nBlocks);
+    if (m < nBlocks) {
+        if (m >= 0 && block.value > blocks[m].value)
+            blocks[m] = block;
+        return;
+    }
+
+    int hashInx = block.pos.findNewHashInx(hashTab, maxHashes);
+    if (hashInx == -1)
+        return;
+    hashTab[hashInx] = nBlocks;
+    blocks[nBlocks++] = block;
+}
+
+void BenchIndex(Configuration& config)
+{
+    printf("\n--- Block index: lookup/insert/improve ---\n");
+    printf("%8s %10s %12s %12s %12s %12s %12s %12s\n",
+        "load", "blocks", "insert ns", "hit ns", "miss ns", "improve ns", "hit probes", "miss probes");
+
+    Block* blocks = (Block*)calloc(config.MaxSharedBlocks, sizeof(Block));
+    int* hashTab = (int*)malloc(config.MaxSharedHashes * sizeof(int));
+    Vec3d* keys = (Vec3d*)malloc(config.MaxSharedBlocks * sizeof(Vec3d));
+
+    float loadFactors[] = { 0.01f, 0.05f, 0.1f, 0.25f, 0.5f, 0.75f };
+    for (float load : loadFactors) {
+        // Use the configured table size while the blocks fit, then shrink the table to reach higher loads.
+        int maxHashes = config.MaxSharedHashes;
+        int target = (int)(load * maxHashes);
+        if (target > config.MaxSharedBlocks) {
+            target = config.MaxSharedBlocks;
+            maxHashes = (int)(target / load);
+        }
+
+        memset(hashTab, 0xFF, maxHashes * sizeof(int));
+        int nBlocks = 0;
+        BinGenerator gen(0xB10C5EED);
+
+        double timerStart = omp_get_wtime();
+        long long inserts = 0;
+        while (nBlocks < target && inserts < 4LL * target) {
+            Block block = { gen.Next(), (float)(Utils::xoro_r(&gen.seed) % 1000), NULL };
+            InsertShared(blocks, hashTab, maxHashes, nBlocks, block);
+            inserts++;
+        }
+        double insertTime = omp_get_wtime() - timerStart;
+
+        for (int n = 0; n < nBlocks; n++)
+            keys[n] = blocks[n].pos;
+
+        int queries = nBlocks < 1000000 ? nBlocks : 1000000;
+        uint64_t pick = 0x5EED;
+        long long hitProbes = 0, missProbes = 0, sink = 0;
+
+        timerStart = omp_get_wtime();
+        for (int q = 0; q < queries; q++)
+            sink += keys[Utils::xoro_r(&pick) % nBlocks].findBlock(blocks, hashTab, maxHashes, 0, nBlocks);
+        double hitTime = omp_get_wtime() - timerStart;
+
+        BinGenerator missGen(0xDEADBEEF);
+        timerStart = omp_get_wtime();
+        for (int q = 0; q < queries; q++) {
+            Vec3d miss = missGen.Next();
+            miss.s += 1; // Odd s never appears in the table, so this is always a miss.
+            sink += miss.findBlock(blocks, hashTab, maxHashes, 0, nBlocks);
+        }
+        double missTime = omp_get_wtime() - timerStart;
+
+        timerStart = omp_get_wtime();
+        for (int q = 0; q < queries; q++) {
+            Block block = { keys[Utils::xoro_r(&pick) % nBlocks], 1000.0f + q, NULL };
+            InsertShared(blocks, hashTab, maxHashes, nBlocks, block);
+        }
+        double improveTime = omp_get_wtime() - timerStart;
+
+        missGen = BinGenerator(0xDEADBEEF);
+        for (int q = 0; q < queries; q++) {
+            hitProbes += Probes(keys[Utils::xoro_r(&pick) % nBlocks], blocks, hashTab, maxHashes, nBlocks);
+            Vec3d miss = missGen.Next();
+            miss.s += 1;
+            missProbes += Probes(miss, blocks, hashTab, maxHashes, nBlocks);
+        }
+
+        gSink = sink;
+        printf("%8.2f %10d %12.1f %12.1f %12.1f %12.1f %12.3f %12.3f\n",
+            (float)nBlocks / maxHashes, nBlocks,
+            1e9 * insertTime / inserts, 1e9 * hitTime / queries, 1e9 * missTime / queries, 1e9 * improveTime / queries,
+            (double)hitProbes / queries, (double)missProbes / queries);
+    }
+
+    free(keys);
+    free(hashTab);
+    free(blocks);
+}
+
+void BenchMerge(Configuration& config, Printer& printer)
+{
+    printf("\n--- MergeBlocks: %d thread-local tables of %d blocks ---\n", config.TotalThreads, config.MaxBlocks);
+    printf("%10s %12s %12s %12s\n", "shared", "merged", "merge ms", "ns/block");
+
+    GlobalState gState(config, printer);
+    for (int tid = 0; tid < config.TotalThreads; tid++)
+        memset(gState.LocalHashTabs[tid], 0xFF, config.MaxHashes * sizeof(int));
+
+    BinGenerator gen(0x3E26E);
+    for (int round = 0; round < 8; round++) {
+        if (gState.NBlocks[config.TotalThreads] + config.TotalThreads * config.MaxBlocks > config.MaxSharedBlocks)
+            break;
+
+        // Each thread explores near the same frontier, so local tables overlap each other and the shared table.
+        long long merged = 0;
+        for (int tid = 0; tid < config.TotalThreads; tid++) {
+            Block* blocks = gState.LocalBlocks[tid];
+            int* hashTab = gState.LocalHashTabs[tid];
+            int& nBlocks = gState.NBlocks[tid];
+            int nShared = gState.NBlocks[config.TotalThreads];
+            for (int attempt = 0; attempt < 2 * config.MaxBlocks && nBlocks < config.MaxBlocks; attempt++) {
+                Block block = { gen.Next(), (float)(Utils::xoro_r(&gen.seed) % 1000), NULL };
+                if (nShared > 0 && Utils::xoro_r(&gen.seed) % 4 == 0)
+                    block.pos = gState.SharedBlocks[Utils::xoro_r(&gen.seed) % nShared].pos;
+                InsertShared(blocks, hashTab, config.MaxHashes, nBlocks, block);
+            }
+            merged += nBlocks;
+        }
+
+        int sharedBefore = gState.NBlocks[config.TotalThreads];
+        double timerStart = omp_get_wtime();
+        gState.MergeBlocks();
+        double mergeTime = omp_get_wtime() - timerStart;
+
+        printf("%10d %12lld %12.2f %12.1f\n", sharedBefore, merged, 1e3 * mergeTime, 1e9 * mergeTime / merged);
+    }
+}
+
+void BenchSegmentGC(Configuration& config, Printer& printer)
+{
+    printf("\n--- SegmentGarbageCollection: %d shared segments ---\n", config.MaxSharedSegments);
+    printf("%10s %12s %12s %12s %12s\n", "tails", "segments", "live", "gc ms", "ns/segment");
+
+    float tailFractions[] = { 0.5f, 0.1f, 0.01f, 0.001f };
+    for (float tailFraction : tailFractions) {
+        GlobalState gState(config, printer);
+        Segment** shared = gState.AllSegments + config.TotalThreads * config.MaxLocalSegments;
+        int nSegs = config.MaxSharedSegments;
+        uint64_t seed = 0x6C6C;
+
+        // Grow a tree where each segment extends a recent one, which gives deep chains with
+        // occasional branching, roughly the shape scattershot produces.
+        for (int n = 0; n < nSegs; n++) {
+            Segment* seg = (Segment*)malloc(sizeof(Segment));
+            seg->seed = Utils::xoro_r(&seed);
+            seg->numFrames = config.SegmentLength;
+            seg->coalesced = 0;
+            seg->refCount = 0;
+            if (n == 0) {
+                seg->parent = NULL;
+                seg->depth = 1;
+            }
+            else {
+                int window = n < 4096 ? n : 4096;
+                seg->parent = shared[n - 1 - Utils::xoro_r(&seed) % window];
+                seg->depth = seg->parent->depth + 1;
+            }
+            shared[n] = seg;
+        }
+        gState.NSegments[config.TotalThreads] = nSegs;
+
+        int nTails = (int)(tailFraction * nSegs);
+        if (nTails > config.MaxSharedBlocks) nTails = config.MaxSharedBlocks;
+        for (int n = 0; n < nTails; n++)
+            gState.SharedBlocks[n].tailSeg = shared[Utils::xoro_r(&seed) % nSegs];
+        gState.NBlocks[config.TotalThreads] = nTails;
+
+        double timerStart = omp_get_wtime();
+        gState.SegmentGarbageCollection();
+        double gcTime = omp_get_wtime() - timerStart;
+
+        int live = gState.NSegments[config.TotalThreads];
+        printf("%10d %12d %12d %12.2f %12.1f\n", nTails, nSegs, live, 1e3 * gcTime, 1e9 * gcTime / nSegs);
+
+        for (int n = 0; n < live; n++)
+            free(shared[n]);
+    }
+}
+
+// The rejection sampler SelectBaseBlock used before BlockSampler, kept for comparison.
+static int RejectionSample(GlobalState& gState, uint64_t* seed, int& attempts)
+{
+    int nShared = gState.NBlocks[gState.config.TotalThreads];
+    for (attempts = 1; attempts <= 100000; attempts++) {
+        int origInx = Utils::xoro_r(seed) % nShared;
+        if (gState.SharedBlocks[origInx].tailSeg == 0) continue;
+        if (gState.SharedBlocks[origInx].tailSeg->depth == 0) continue;
+        int normInfo = gState.SharedBlocks[origInx].pos.s % 900;
+        float xNorm = (float)((int)normInfo / 30);
+        float zNorm = (float)(normInfo % 30);
+        float approxXZSum = fabs((xNorm - 15) / 15) + fabs((zNorm - 15) / 15) + .01;
+        if (((float)(Utils::xoro_r(seed) % 50) / 100 < approxXZSum * approxXZSum) & (gState.SharedBlocks[origInx].tailSeg->depth < gState.config.MaxSegments))
+            return origInx;
+    }
+    return -1;
+}
+
+void BenchSampler(Configuration& config, Printer& printer)
+{
+    printf("\n--- Base block selection: rejection vs alias table ---\n");
+    printf("%10s %12s %14s %14s %14s\n", "blocks", "rebuild ms", "reject ns", "reject tries", "alias ns");
+
+    GlobalState gState(config, printer);
+    Segment segs[256];
+    for (int d = 0; d < 256; d++) {
+        segs[d].depth = d + 1;
+        segs[d].parent = d > 0 ? &segs[d - 1] : NULL;
+    }
+
+    BinGenerator gen(0x5A3F);
+    int sizes[] = { 100000, 1000000, 10000000, 20000000 };
+    for (int size : sizes) {
+        if (size > config.MaxSharedBlocks) break;
+
+        int& nShared = gState.NBlocks[config.TotalThreads];
+        for (; nShared < size; nShared++) {
+            gState.SharedBlocks[nShared].pos = gen.Next();
+            gState.SharedBlocks[nShared].tailSeg = &segs[Utils::xoro_r(&gen.seed) % 256];
+        }
+
+        gState.Sampler.Rebuild(gState);
+
+        int samples = 1000000;
+        uint64_t seed = 0x5E1EC7;
+        long long tries = 0, sink = 0;
+        double timerStart = omp_get_wtime();
+        for (int i = 0; i < samples; i++) {
+            int attempts;
+            sink += RejectionSample(gState, &seed, attempts);
+            tries += attempts;
+        }
+        double rejectTime = omp_get_wtime() - timerStart;
+
+        timerStart = omp_get_wtime();
+        for (int i = 0; i < samples; i++)
+            sink += gState.Sampler.Sample(&seed);
+        double aliasTime = omp_get_wtime() - timerStart;
+
+        gSink = sink;
+        printf("%10d %12.2f %14.1f %14.2f %14.1f\n", size, 1e3 * gState.Sampler.RebuildTime,
+            1e9 * rejectTime / samples, (double)tries / samples, 1e9 * aliasTime / samples);
+    }
+}
+
+static int CompareBlockPos(const void* a, const void* b)
+{
+    const Vec3d& x = ((const Block*)a)->pos;
+    const Vec3d& y = ((const Block*)b)->pos;
+    if (x.x != y.x) return x.x < y.x ? -1 : 1;
+    if (x.y != y.y) return x.y < y.y ? -1 : 1;
+    if (x.z != y.z) return x.z < y.z ? -1 : 1;
+    if (x.s != y.s) return x.s < y.s ? -1 : 1;
+    return 0;
+}
+
+// Like GlobalState::Digest, but over the blocks in bin order, since spilling changes the
+// order in which merges append new bins to the shared table but not which blocks it holds.
+static uint64_t TableDigest(GlobalState& gState)
+{
+    int nShared = gState.NBlocks[gState.config.TotalThreads];
+    Block* blocks = (Block*)malloc((nShared + 1) * sizeof(Block));
+    memcpy(blocks, gState.SharedBlocks, nShared * sizeof(Block));
+    qsort(blocks, nShared, sizeof(Block), CompareBlockPos);
+
+    uint64_t hash = 14695981039346656037ULL;
+    for (int blockInd = 0; blockInd < nShared; blockInd++) {
+        Block& block = blocks[blockInd];
+        uint64_t fields[6] = { (uint64_t)block.pos.x | (uint64_t)block.pos.y << 8 | (uint64_t)block.pos.z << 16, block.pos.s, 0,
+            block.tailSeg->lastSeed(), block.tailSeg->depth, block.tailSeg->numFrames };
+        memcpy(&fields[2], &block.value, sizeof(float));
+        const uint8_t* bytes = (const uint8_t*)fields;
+        for (int n = 0; n < (int)sizeof(fields); n++) {
+            hash ^= bytes[n];
+            hash *= 1099511628211ULL;
+        }
+    }
+    free(blocks);
+    return hash;
+}
+
+// Runs the loaded traces through the real block tables, merge and GC, prints per-thread
+// timings and returns the digest of the final shared table.
+static uint64_t ReplayRecords(Configuration& config, TraceRecord** records, long long* nRecords, int merges, Printer& printer)
+{
+    int nThreads = config.TotalThreads;
+    GlobalState gState(config, printer);
+    double mergeTime = 0, gcTime = 0, samplerTime = 0;
+    double selectTime[256] = { 0 }, processTime[256] = { 0 };
+    long long selects[256] = { 0 }, processed[256] = { 0 }, baseMisses[256] = { 0 };
+
+    double replayStart = omp_get_wtime();
+    Utils::MultiThread(nThreads, [&]()
+        {
+            int tid = omp_get_thread_num();
+            ThreadState tState(config, gState, tid);
+            int merged = 0;
+            Block stored = { 0 };
+
+            for (long long r = 0; r < nRecords[tid] && merged < merges; r++) {
+                TraceRecord& rec = records[tid][r];
+                Vec3d pos = { rec.x, rec.y, rec.z, rec.s };
+
+                if (rec.op == TRACE_INIT) {
+                    tState.Initialize(pos);
+                }
+                else if (rec.op == TRACE_MERGE) {
+                    merged++;
+                    Utils::SingleThread([&]()
+                        {
+                            // The steps of GlobalState::MergeState in its order, with GC
+                            // run where the recording ran it rather than on this run's schedule.
+                            double timerStart = omp_get_wtime();
+                            gState.MergeStats();
+                            gState.Bins.Update(gState);
+                            gState.MergeBlocks();
+                            gState.Bins.Fold(gState);
+                            gState.MergeSegments();
+                            int evicted = gState.EvictBlocks();
+                            mergeTime += omp_get_wtime() - timerStart;
+
+                            // The recording marked the merges that ran GC on schedule.
+                            if (rec.numFrames || evicted > 0) {
+                                timerStart = omp_get_wtime();
+                                gState.SegmentGarbageCollection();
+                                gcTime += omp_get_wtime() - timerStart;
+                            }
+                        });
+                    gState.Sampler.Rebuild(gState);
+                    #pragma omp master
+                    samplerTime += gState.Sampler.RebuildTime;
+                }
+                else if (rec.op == TRACE_SELECT_BASE) {
+                    double timerStart = omp_get_wtime();
+                    int nShared = gState.NBlocks[config.TotalThreads];
+                    int origInx = pos.findBlock(gState.SharedBlocks, gState.SharedHashTab, config.MaxSharedHashes, 0, nShared);
+                    if (origInx < 0 || origInx >= nShared) {
+                        // The replayed table can differ from the recorded one if the run dropped blocks.
+                        baseMisses[tid]++;
+                        origInx = rec.seed < (uint64_t)nShared ? (int)rec.seed : 0;
+                    }
+                    tState.BaseBlock = gState.SharedBlocks[origInx];
+                    tState.LogShot(origInx);
+                    selectTime[tid] += omp_get_wtime() - timerStart;
+                    selects[tid]++;
+                }
+                else if (rec.op == TRACE_NEW_BLOCK) {
+                    double timerStart = omp_get_wtime();
+                    tState.ProcessNewBlock(rec.seed, rec.numFrames, pos, rec.value, &stored);
+                    processTime[tid] += omp_get_wtime() - timerStart;
+                    processed[tid]++;
+                }
+                else if (rec.op == TRACE_BRANCH) {
+                    tState.BaseBlock = stored;
+                }
+            }
+        });
+    double replayTime = omp_get_wtime() - replayStart;
+
+    printf("\n--- Trace replay, %d local blocks ---\n", config.MaxBlocks);
+    printf("%6s %12s %12s %12s %12s %12s\n", "thread", "selects", "select ns", "new blocks", "process ns", "base misses");
+    for (int tid = 0; tid < nThreads; tid++) {
+        printf("%6d %12lld %12.1f %12lld %12.1f %12lld\n", tid,
+            selects[tid], selects[tid] ? 1e9 * selectTime[tid] / selects[tid] : 0.0,
+            processed[tid], processed[tid] ? 1e9 * processTime[tid] / processed[tid] : 0.0, baseMisses[tid]);
+    }
+    printf("Shared blocks %d, shared segments %d\n", gState.NBlocks[config.TotalThreads], gState.NSegments[config.TotalThreads]);
+    printf("Spilled blocks %lld, segments %lld\n", gState.SpilledBlocks, gState.SpilledSegments);
+    printf("Merge %.3f s, segment GC %.3f s, sampler rebuild %.3f s, total %.3f s\n", mergeTime, gcTime, samplerTime, replayTime);
+
+    return TableDigest(gState);
+}
+
+// Replays traces written with Configuration::RecordTrace. Files are <prefix>_trace_<thread>.bin,
+// as written by ThreadState. With localBlocks, the traces are replayed a second time with
+// local tables that small, which makes the threads spill, and the two shared tables compared.
+int ReplayTrace(const char* prefix, Printer& printer, int localBlocks)
+{
+    TraceHeader header;
+    TraceRecord* records[256];
+    long long nRecords[256];
+    int nMerges[256];
+    int nThreads = 0;
+
+    for (; nThreads < 256; nThreads++) {
+        char traceName[256] = { 0 };
+        sprintf(traceName, "%s_trace_%d.bin", prefix, nThreads);
+        FILE* fp = fopen(traceName, "rb");
+        if (!fp) break;
+
+        fread(&header, sizeof(TraceHeader), 1, fp);
+        if (memcmp(header.magic, "SSTR", 4) != 0 || header.version != TraceRecorder::Version) {
+            printf("%s is not a version %u trace!\n", traceName, TraceRecorder::Version);
+            fclose(fp);
+            return 1;
+        }
+
+        // Traces of long runs pass 2GB, past what the 32-bit long of ftell can hold on Windows.
+        _fseeki64(fp, 0, SEEK_END);
+        nRecords[nThreads] = (_ftelli64(fp) - (long long)sizeof(TraceHeader)) / sizeof(TraceRecord);
+        _fseeki64(fp, sizeof(TraceHeader), SEEK_SET);
+        records[nThreads] = (TraceRecord*)malloc(nRecords[nThreads] * sizeof(TraceRecord));
+        nRecords[nThreads] = fread(records[nThreads], sizeof(TraceRecord), nRecords[nThreads], fp);
+        fclose(fp);
+
+        nMerges[nThreads] = 0;
+        for (long long r = 0; r < nRecords[nThreads]; r++)
+            if (records[nThreads][r].op == TRACE_MERGE) nMerges[nThreads]++;
+    }
+
+    if (nThreads == 0) {
+        printf("No trace files found for %s\n", prefix);
+        return 1;
+    }
+
+    Configuration config = header.config;
+    config.TotalThreads = nThreads;
+    config.RecordTrace = 0;
+    config.SnapshotInterval = 0;
+
+    // Every thread has to hit the same merge barriers, so stop at the shortest trace.
+    int merges = nMerges[0];
+    for (int tid = 1; tid < nThreads; tid++)
+        if (nMerges[tid] < merges) merges = nMerges[tid];
+    printf("Replaying %d threads, %d merges\n", nThreads, merges);
+
+    uint64_t digest = ReplayRecords(config, records, nRecords, merges, printer);
+    int result = 0;
+    if (localBlocks > 0) {
+        // Hash slots and local segments keep their recorded ratio to local blocks.
+        Configuration small = config;
+        small.MaxBlocks = localBlocks;
+        small.MaxHashes = (int)((long long)config.MaxHashes * localBlocks / config.MaxBlocks);
+        small.MaxLocalSegments = (int)((long long)config.MaxLocalSegments * localBlocks / config.MaxBlocks);
+        uint64_t spilledDigest = ReplayRecords(small, records, nRecords, merges, printer);
+        printf("\nShared table with %d local blocks %s the one with %d (%016llx, %016llx)\n", localBlocks,
+            spilledDigest == digest ? "matches" : "DIFFERS from", config.MaxBlocks, (unsigned long long)spilledDigest, (unsigned long long)digest);
+        result = spilledDigest == digest ? 0 : 2;
+    }
+
+    for (int tid = 0; tid < nThreads; tid++)
+        free(records[tid]);
+    return result;
+}
+
+int main(int argc, char* argv[])
+{
+    Printer printer;
+    printer.gPrint = 0;
+    printer.gLog = 0;
+
+    if (argc > 2 && !strcmp(argv[1], "-replay"))
+        return ReplayTrace(argv[2], printer, argc > 3 ? atoi(argv[3]) : 0);
+
+    Configuration config;
+    config.SegmentLength = 10;
+    config.MaxSharedBlocks = argc > 1 ? atoi(argv[1]) : 20000000;
+    config.MaxSharedHashes = 10 * config.MaxSharedBlocks;
+    config.MaxSharedSegments = argc > 2 ? atoi(argv[2]) : 25000000;
+    config.TotalThreads = argc > 3 ? atoi(argv[3]) : 4;
+    config.MaxSegments = 1024;
+    config.MaxBlocks = 500000;
+    config.MaxHashes = 10 * config.MaxBlocks;
+    config.MaxLocalSegments = 0;
+    config.MaxLightningLength = 0;
+    config.RecordTrace = 0;
+    config.ResultArchive = 0;
+    config.NoveltyFilterLogBits = 0;
+    config.NoveltyMaxFalsePositive = 0.05;
+    config.SelectionPolicy = POLICY_HEURISTIC;
+    config.UcbExploration = 0.5;
+    config.RetireAfterShots = 50;
+    config.TuneMode = TUNE_OFF;
+    config.LargePages = LARGE_PAGES_OFF;
+    config.EvictHighWatermark = 0.9;
+    config.EvictLowWatermark = 0.8;
+    config.Deterministic = 0;
+    config.RestartAfterFaults = 3;
+    config.BranchFanout = 0;
+    config.TopK = 0;
+    config.ExportInterval = 0;
+    config.MaxSplitLevel = 0;
+    config.MaxSplits = 0;
+    config.SplitVisits = 0;
+    config.SplitSpread = 0;
+    config.MergeColdAfter = 0;
+    config.VisitSampleMask = 0;
+    config.SegmentExitMultiple = 0;
+    config.CoalesceSegments = 0;
+    config.LightningPaths = 0;
+    config.SnapshotInterval = 0;
+    config.Strategy = STRATEGY_SCATTERSHOT;
+    config.StrategyMerges = 0;
+    config.BeamWidth = 0;
+    config.RefinePaths = 0;
+    config.RefineSegments = 0;
+    config.BatchShots = 0;
+    config.ReplayStackStates = 0;
+
+    printf("Benchmark config: shared blocks %d, shared hashes %d, shared segments %d, threads %d\n",
+        config.MaxSharedBlocks, config.MaxSharedHashes, config.MaxSharedSegments, config.TotalThreads);
+
+    BenchIndex(config);
+    BenchMerge(config, printer);
+    BenchSegmentGC(config, printer);
+    BenchSampler(config, printer);
+
+    return 0;
+}
@@ -0,0 +1,123 @@
+#include <Scattershot.hpp>
+
+BlockSampler::BlockSampler()
+{
+    Weight = NormWeight;
+}
+
+BlockSampler::~BlockSampler()
+{
+    free(prob);
+    free(alias);
+    free(work);
+}
+
+float BlockSampler::NormWeight(GlobalState& gState, int blockInx)
+{
+    Block& block = gState.SharedBlocks[blockInx];
+    if (block.tailSeg == 0) { Printer::Warn(WARN_CHOSEN_TAILSEG_NULL); return 0; }
+    if (block.tailSeg->depth == 0) { Printer::Warn(WARN_CHOSEN_DEPTH_ZERO); return 0; }
+    if (block.tailSeg->depth >= gState.config.MaxSegments) return 0;
+    if (gState.Failing(blockInx)) return 0;
+    if (gState.Bins.IsSplit(block.pos)) return 0;
+
+    int normInfo = (block.pos.s & Partition::BinMask) % 900;
+    float xNorm = (float)((int)normInfo / 30);
+    float zNorm = (float)(normInfo % 30);
+    float approxXZSum = fabs((xNorm - 15) / 15) + fabs((zNorm - 15) / 15) + .01;
+
+    // The rejection sampler accepted a draw when (xoro % 50) / 100 < approxXZSum^2, that is
+    // with probability ceil(100 * approxXZSum^2) / 50 capped at 1. The continuous 2x^2 below
+    // only approximates that step function; it is up to 1/50 lower at each step.
+    float weight = 2 * approxXZSum * approxXZSum;
+    return weight < 1 ? weight : 1;
+}
+
+float BlockSampler::UcbWeight(GlobalState& gState, int blockInx)
+{
+    float weight = NormWeight(gState, blockInx);
+    if (weight == 0) return 0;
+
+    BlockStats& stats = gState.SharedStats[blockInx];
+    uint32_t yield = stats.discoveries + stats.improvements;
+    if (yield == 0 && stats.shots >= (uint32_t)gState.config.RetireAfterShots) return 0;
+
+    // ln(TotalShots + 2) keeps the bonus positive before the first shots are merged.
+    float mean = (float)yield / (stats.shots + 1);
+    float bonus = gState.config.UcbExploration * sqrtf(logf((float)gState.TotalShots + 2) / (stats.shots + 1));
+    return weight * (mean + bonus);
+}
+
+// Must be called by every thread of the enclosing parallel region (or outside of one).
+void BlockSampler::Rebuild(GlobalState& gState)
+{
+    #pragma omp single
+    {
+        RebuildTime = omp_get_wtime();
+        NumBlocks = gState.NBlocks[gState.config.TotalThreads];
+        if (NumBlocks > capacity) {
+            capacity = NumBlocks + NumBlocks / 2;
+            prob = (float*)realloc(prob, capacity * sizeof(float));
+            alias = (int*)realloc(alias, capacity * sizeof(int));
+            work = (int*)realloc(work, capacity * sizeof(int));
+        }
+    }
+
+    #pragma omp for schedule(static)
+    for (int i = 0; i < NumBlocks; i++)
+        prob[i] = Weight(gState, i);
+
+    #pragma omp single
+    {
+        TotalWeight = 0;
+        NumWeighted = 0;
+        for (int i = 0; i < NumBlocks; i++) {
+            TotalWeight += prob[i];
+            if (prob[i] > 0) NumWeighted++;
+        }
+
+        if (NumWeighted > 0) {
+            // Vose: scale weights to mean 1, then pair each under-full entry with an
+            // over-full one. Small entries stack up from the front of work, large from the back.
+            double scale = NumBlocks / TotalWeight;
+            int nSmall = 0, nLarge = NumBlocks;
+            for (int i = 0; i < NumBlocks; i++) {
+                prob[i] = (float)(prob[i] * scale);
+                if (prob[i] < 1) work[nSmall++] = i;
+                else work[--nLarge] = i;
+            }
+
+            while (nSmall > 0 && nLarge < NumBlocks) {
+                int small = work[--nSmall];
+                int large = work[nLarge++];
+                alias[small] = large;
+                prob[large] = (prob[large] + prob[small]) - 1;
+                if (prob[large] < 1) work[nSmall++] = large;
+                else work[--nLarge] = large;
+            }
+
+            // Whatever is left is 1 up to rounding.
+            while (nSmall > 0) {
+                int i = work[--nSmall];
+                prob[i] = 1;
+                alias[i] = i;
+            }
+            while (nLarge < NumBlocks) {
+                int i = work[nLarge++];
+                prob[i] = 1;
+                alias[i] = i;
+            }
+        }
+
+        RebuildTime = omp_get_wtime() - RebuildTime;
+    }
+}
+
+int BlockSampler::Sample(uint64_t* seed)
+{
+    if (NumWeighted == 0) return -1;
+
+    int i = Utils::xoro_r(seed) % NumBlocks;
+    float u = (Utils::xoro_r(seed) >> 8) * (1.0f / 16777216.0f);
+    return u < prob[i] ? i : alias[i];
+}
@@ -1,102 +1,702 @@
 #include <Scattershot.hpp>
 
-GlobalState::GlobalState(Configuration& config, Printer& printer) : config(config), printer(printer)
+GlobalState::GlobalState(Configuration& config, Printer& printer, int target, const char* targetName) : config(config), printer(printer)
 {
-    AllBlocks = (Block*)calloc(config.TotalThreads * config.MaxBlocks + config.MaxSharedBlocks, sizeof(Block));
+    if (targetName)
+        sprintf(OutputName, "%s_%s", printer.gProgName, targetName);
+    else
+        strcpy(OutputName, printer.gProgName);
+
+    // Each thread's tables live on its own NUMA node; the shared ones are read by every
+    // thread, so they are spread over all nodes.
+    LocalBlocks = (Block**)calloc(config.TotalThreads, sizeof(Block*));
+    LocalHashTabs = (int**)calloc(config.TotalThreads, sizeof(int*));
+    for (int tid = 0; tid < config.TotalThreads; tid++) {
+        LocalBlocks[tid] = (Block*)Memory::Alloc(config.MaxBlocks * sizeof(Block), Memory::ThreadNode(tid));
+        LocalHashTabs[tid] = (int*)Memory::Alloc(config.MaxHashes * sizeof(int), Memory::ThreadNode(tid));
+    }
+    SharedBlocks = (Block*)Memory::AllocInterleaved(config.MaxSharedBlocks * sizeof(Block));
+    SharedHashTab = (int*)Memory::AllocInterleaved(config.MaxSharedHashes * sizeof(int));
     AllSegments = (struct Segment**)malloc((config.MaxSharedSegments + config.TotalThreads * config.MaxLocalSegments) * sizeof(struct Segment*));
-    AllHashTabs = (int*)calloc(config.TotalThreads * config.MaxHashes + config.MaxSharedHashes, sizeof(int));
     NBlocks = (int*)calloc(config.TotalThreads + 1, sizeof(int));
     NSegments = (int*)calloc(config.TotalThreads + 1, sizeof(int));
-    SharedBlocks = AllBlocks + config.TotalThreads * config.MaxBlocks;
-    SharedHashTab = AllHashTabs + config.TotalThreads * config.MaxHashes;
+    SharedStats = (BlockStats*)calloc(config.MaxSharedBlocks, sizeof(BlockStats));
+    ShotLogs = (ShotRecord**)calloc(config.TotalThreads, sizeof(ShotRecord*));
+    NShots = (int*)calloc(config.TotalThreads, sizeof(int));
+    ShotLogCapacity = (int*)calloc(config.TotalThreads, sizeof(int));
+    VisitLogs = (VisitRecord**)calloc(config.TotalThreads, sizeof(VisitRecord*));
+    NVisits = (int*)calloc(config.TotalThreads, sizeof(int));
+    VisitLogCapacity = (int*)calloc(config.TotalThreads, sizeof(int));
+    Spills = (SpillQueue*)calloc(config.TotalThreads, sizeof(SpillQueue));
+    ExportInputs = (Input**)calloc(config.TopK + 1, sizeof(Input*));
+    ExportLengths = (int*)calloc(config.TopK + 1, sizeof(int));
+    Top.Init(config.TopK);
+    Bins.Init(config.MaxSplits, config.MaxSplitLevel);
+    Lightning = (int*)malloc(config.MaxLightningLength * sizeof(int));
+    Search.Init(config.BeamWidth, config.RefinePaths);
+    if (config.SnapshotInterval > 0)
+        Snapshot.Open(config.MaxSharedBlocks, printer, target);
 
     // Init shared hash table.
     for (int hashInx = 0; hashInx < config.MaxSharedHashes; hashInx++)
         SharedHashTab[hashInx] = -1;
+
+    // The novelty filter skips work based on what other threads have run so far.
+    if (config.NoveltyFilterLogBits > 0 && !config.Deterministic)
+        Novelty.Init(config.NoveltyFilterLogBits, 4);
+}
+
+GlobalState::~GlobalState()
+{
+    for (int tid = 0; tid < config.TotalThreads; tid++) {
+        Memory::Free(LocalBlocks[tid]);
+        Memory::Free(LocalHashTabs[tid]);
+    }
+    free(LocalBlocks);
+    free(LocalHashTabs);
+    Memory::Free(SharedBlocks);
+    Memory::Free(SharedHashTab);
+    free(AllSegments);
+    free(NBlocks);
+    free(NSegments);
+    free(SharedStats);
+    for (int tid = 0; tid < config.TotalThreads; tid++)
+        free(ShotLogs[tid]);
+    free(ShotLogs);
+    free(NShots);
+    free(ShotLogCapacity);
+    for (int tid = 0; tid < config.TotalThreads; tid++)
+        free(VisitLogs[tid]);
+    free(VisitLogs);
+    free(NVisits);
+    free(VisitLogCapacity);
+    free(Lightning);
+    for (int tid = 0; tid < config.TotalThreads; tid++) {
+        for (int n = 0; n < Spills[tid].nBuffers; n++)
+            Memory::Free(Spills[tid].buffers[n]);
+        free(Spills[tid].buffers);
+        free(Spills[tid].bufferBlocks);
+        free(Spills[tid].segments);
+    }
+    free(Spills);
+    free(ExportInputs);
+    free(ExportLengths);
+}
+
+// Orders candidates by bin, and within a bin best first, so that merging a sorted list
+// assigns shared indices and picks winners the same way whichever thread found what.
+static int CompareMergeCandidates(const void* a, const void* b)
+{
+    Block* x = (Block*)a;
+    Block* y = (Block*)b;
+    if (x->pos.x != y->pos.x) return x->pos.x - y->pos.x;
+    if (x->pos.y != y->pos.y) return x->pos.y - y->pos.y;
+    if (x->pos.z != y->pos.z) return x->pos.z - y->pos.z;
+    if (x->pos.s != y->pos.s) return x->pos.s < y->pos.s ? -1 : 1;
+    BlockKey kx = x->key(), ky = y->key();
+    if (Block::Beats(kx, ky)) return -1;
+    if (Block::Beats(ky, kx)) return 1;
+    return 0;
 }
 
 void GlobalState::MergeBlocks()
 {
     printer.printfQ("Merging blocks.\n");
 
-    int otid, n, m;
-    for (otid = 0; otid < config.TotalThreads; otid++) {
-        for (n = 0; n < NBlocks[otid]; n++) {
-            Block tmpBlock = AllBlocks[otid * config.MaxBlocks + n];
-            m = tmpBlock.pos.findBlock(SharedBlocks, SharedHashTab, config.MaxSharedHashes, 0, NBlocks[config.TotalThreads]);
-            if (m < NBlocks[config.TotalThreads]) {
-                if (tmpBlock.value > SharedBlocks[m].value) { // changed to >
-                    SharedBlocks[m] = tmpBlock;
-                }
-            }
-            else {
-                SharedHashTab[tmpBlock.pos.findNewHashInx(SharedHashTab, config.MaxSharedHashes)] = NBlocks[config.TotalThreads];
-                SharedBlocks[NBlocks[config.TotalThreads]++] = tmpBlock;
+    int otid, b;
+    if (config.Deterministic) {
+        int nCandidates = 0;
+        for (otid = 0; otid < config.TotalThreads; otid++) {
+            for (b = 0; b < Spills[otid].nBuffers; b++)
+                nCandidates += Spills[otid].bufferBlocks[b];
+            nCandidates += NBlocks[otid];
+        }
+
+        Block* candidates = (Block*)malloc((nCandidates + 1) * sizeof(Block));
+        nCandidates = 0;
+        for (otid = 0; otid < config.TotalThreads; otid++) {
+            SpillQueue& spill = Spills[otid];
+            for (b = 0; b < spill.nBuffers; b++) {
+                memcpy(candidates + nCandidates, spill.buffers[b], spill.bufferBlocks[b] * sizeof(Block));
+                nCandidates += spill.bufferBlocks[b];
+                Memory::Free(spill.buffers[b]);
             }
+            spill.nBuffers = 0;
+
+            memcpy(candidates + nCandidates, LocalBlocks[otid], NBlocks[otid] * sizeof(Block));
+            nCandidates += NBlocks[otid];
         }
+
+        qsort(candidates, nCandidates, sizeof(Block), CompareMergeCandidates);
+        MergeBuffer(candidates, nCandidates);
+        free(candidates);
     }
+    else {
+        for (otid = 0; otid < config.TotalThreads; otid++) {
+            // Newest buffer first. A local table lets a later block replace an equal one, and
+            // MergeBuffer keeps the first of equals, so this picks the same block among a
+            // thread's copies of a bin as one unbounded local table would have.
+            MergeBuffer(LocalBlocks[otid], NBlocks[otid]);
 
-    memset(AllHashTabs, 0xFF, config.MaxHashes * config.TotalThreads * sizeof(int)); // Clear all local hash tables.
+            SpillQueue& spill = Spills[otid];
+            for (b = spill.nBuffers - 1; b >= 0; b--) {
+                MergeBuffer(spill.buffers[b], spill.bufferBlocks[b]);
+                Memory::Free(spill.buffers[b]);
+            }
+            spill.nBuffers = 0;
+        }
+    }
 
     for (otid = 0; otid < config.TotalThreads; otid++) {
+        memset(LocalHashTabs[otid], 0xFF, config.MaxHashes * sizeof(int)); // Clear all local hash tables.
         NBlocks[otid] = 0; // Clear all local blocks.
     }
 }
 
+void GlobalState::MergeBuffer(Block* blocks, int nBlocks)
+{
+    int n, m;
+    for (n = 0; n < nBlocks; n++) {
+        Block tmpBlock = blocks[n];
+        m = tmpBlock.pos.findBlock(SharedBlocks, SharedHashTab, config.MaxSharedHashes, 0, NBlocks[config.TotalThreads]);
+        if (m < NBlocks[config.TotalThreads]) {
+            if (config.Deterministic ? Block::Beats(tmpBlock.key(), SharedBlocks[m].key()) : tmpBlock.value > SharedBlocks[m].value) { // changed to >
+                SharedBlocks[m] = tmpBlock;
+                Top.Offer(m, tmpBlock.value);
+                Tuning.Epoch.newBlocks++;
+            }
+        }
+        else if (NBlocks[config.TotalThreads] == config.MaxSharedBlocks) {
+            DroppedBlocks++; // Only if eviction cannot keep up; EvictBlocks runs after every merge.
+        }
+        else {
+            SharedHashTab[tmpBlock.pos.findNewHashInx(SharedHashTab, config.MaxSharedHashes)] = NBlocks[config.TotalThreads];
+            Top.Offer(NBlocks[config.TotalThreads], tmpBlock.value);
+            SharedBlocks[NBlocks[config.TotalThreads]++] = tmpBlock;
+            Tuning.Epoch.newBlocks++;
+        }
+    }
+}
+
+static void FreeSegment(Segment* seg)
+{
+    if (seg->coalesced) free(seg->runs);
+    free(seg);
+}
+
+// Moves every thread's spilled and local segments to the shared list, which holds at most
+// MaxSharedSegments. If they would not fit, segments no merged block leads to are freed
+// first. If the live ones still do not fit, the rest are dropped along with the blocks that
+// end on them. A thread lists its segments after their parents, so nothing that fits
+// descends from a dropped segment.
 void GlobalState::MergeSegments()
 {
-    printf("Merging segments\n");
+    printer.printfQ("Merging segments\n");
+
+    int sharedStart = config.TotalThreads * config.MaxLocalSegments;
+    int incoming = 0;
+    for (int threadNum = 0; threadNum < config.TotalThreads; threadNum++)
+        incoming += Spills[threadNum].nSegments + NSegments[threadNum];
 
-    // Get reference counts for each segment. Tried to track this but ran into
-    // multi-threading issues, so might as well recompute here.
+    bool collect = NSegments[config.TotalThreads] + incoming > config.MaxSharedSegments;
+    if (collect) {
+        for (int segInd = sharedStart; segInd < sharedStart + NSegments[config.TotalThreads]; segInd++)
+            AllSegments[segInd]->refCount = 0;
+        for (int threadNum = 0; threadNum < config.TotalThreads; threadNum++) {
+            for (int n = 0; n < Spills[threadNum].nSegments; n++)
+                Spills[threadNum].segments[n]->refCount = 0;
+            for (int n = 0; n < NSegments[threadNum]; n++)
+                AllSegments[threadNum * config.MaxLocalSegments + n]->refCount = 0;
+        }
+        for (int blockInd = 0; blockInd < NBlocks[config.TotalThreads]; blockInd++) {
+            Segment* curSeg = SharedBlocks[blockInd].tailSeg;
+            while (curSeg != 0 && curSeg->refCount++ == 0)
+                curSeg = curSeg->parent;
+        }
+        for (int segInd = sharedStart; segInd < sharedStart + NSegments[config.TotalThreads]; segInd++) {
+            Segment* curSeg = AllSegments[segInd];
+            if (curSeg->refCount != 0) continue;
+            AllSegments[segInd] = AllSegments[sharedStart + NSegments[config.TotalThreads] - 1];
+            NSegments[config.TotalThreads]--;
+            segInd--;
+            FreeSegment(curSeg);
+        }
+    }
+
+    const uint32_t dropped = 0xFFFFFFFF;
+    Segment** droppedSegs = NULL;
+    int nDropped = 0;
     for (int threadNum = 0; threadNum < config.TotalThreads; threadNum++) {
-        for (int segInd = threadNum * config.MaxLocalSegments; segInd < threadNum * config.MaxLocalSegments + NSegments[threadNum]; segInd++) {
-            //printf("%d %d\n", segInd, numSegs[totThreads]);
-            AllSegments[config.TotalThreads * config.MaxLocalSegments + NSegments[config.TotalThreads]] = AllSegments[segInd];
-            NSegments[config.TotalThreads]++;
-            AllSegments[segInd] = 0;
+        SpillQueue& spill = Spills[threadNum];
+        int nLocal = NSegments[threadNum];
+        for (int n = 0; n < spill.nSegments + nLocal; n++) {
+            Segment*& slot = n < spill.nSegments ? spill.segments[n] : AllSegments[threadNum * config.MaxLocalSegments + n - spill.nSegments];
+            Segment* seg = slot;
+            slot = 0;
+            if (collect && seg->refCount == 0) {
+                FreeSegment(seg);
+            }
+            else if (NSegments[config.TotalThreads] < config.MaxSharedSegments) {
+                AllSegments[sharedStart + NSegments[config.TotalThreads]++] = seg;
+            }
+            else {
+                if (!droppedSegs) droppedSegs = (Segment**)malloc(incoming * sizeof(Segment*));
+                seg->refCount = dropped;
+                droppedSegs[nDropped++] = seg;
+            }
         }
+        spill.nSegments = 0;
         NSegments[threadNum] = 0;
     }
+    if (nDropped == 0) return;
+
+    char* remove = (char*)calloc(NBlocks[config.TotalThreads], 1);
+    int nRemoved = 0;
+    for (int blockInd = 0; blockInd < NBlocks[config.TotalThreads]; blockInd++) {
+        if (SharedBlocks[blockInd].tailSeg->refCount != dropped) continue;
+        remove[blockInd] = 1;
+        nRemoved++;
+    }
+    RemoveBlocks(remove);
+    free(remove);
+
+    for (int n = 0; n < nDropped; n++) {
+        FreeSegment(droppedSegs[n]);
+    }
+    free(droppedSegs);
+
+    DroppedBlocks += nRemoved;
+    DroppedSegments += nDropped;
+    printer.printfQ("Shared segments full: dropped %d segments and %d blocks\n", nDropped, nRemoved);
 }
 
 void GlobalState::SegmentGarbageCollection()
 {
-    printf("Segment garbage collection. Start with %d segments\n", NSegments[config.TotalThreads]);
+    printer.printfQ("Segment garbage collection. Start with %d segments\n", NSegments[config.TotalThreads]);
 
     for (int segInd = config.TotalThreads * config.MaxLocalSegments; segInd < config.TotalThreads * config.MaxLocalSegments + NSegments[config.TotalThreads]; segInd++) {
         AllSegments[segInd]->refCount = 0;
     }
-    for (int segInd = config.TotalThreads * config.MaxLocalSegments; segInd < config.TotalThreads * config.MaxLocalSegments + NSegments[config.TotalThreads]; segInd++) {
-        if (AllSegments[segInd]->parent != 0) { AllSegments[segInd]->parent->refCount++; }
-    }
+
+    // Mark: walk up from every block until reaching a segment some other block already
+    // reached. Each live segment is visited once, and a whole dead chain (such as one
+    // left behind by an evicted block) is collected in a single pass.
     for (int blockInd = 0; blockInd < NBlocks[config.TotalThreads]; blockInd++) {
-        SharedBlocks[blockInd].tailSeg->refCount++;
+        Segment* curSeg = SharedBlocks[blockInd].tailSeg;
+        while (curSeg != 0 && curSeg->refCount++ == 0)
+            curSeg = curSeg->parent;
     }
+
     for (int segInd = config.TotalThreads * config.MaxLocalSegments; segInd < config.TotalThreads * config.MaxLocalSegments + NSegments[config.TotalThreads]; segInd++) {
         Segment* curSeg = AllSegments[segInd];
         if (curSeg->refCount == 0) {
-            //printf("removing a seg\n");
-            if (curSeg->parent != 0) { curSeg->parent->refCount -= 1; }
             //printf("moving %d %d\n", segInd, totThreads*maxLocalSegs+numSegs[totThreads]);
             AllSegments[segInd] = AllSegments[config.TotalThreads * config.MaxLocalSegments + NSegments[config.TotalThreads] - 1];
             NSegments[config.TotalThreads]--;
             segInd--;
-            free(curSeg);
+            FreeSegment(curSeg);
+        }
+    }
+
+    if (config.CoalesceSegments) {
+        int coalesced = CoalesceSegments();
+        CoalescedSegments += coalesced;
+        printer.printfQ("Coalesced %d segments\n", coalesced);
+    }
+
+    printer.printfQ("Segment garbage collection finished. Ended with %d segments\n", NSegments[config.TotalThreads]);
+}
+
+static int CountRuns(Segment* seg)
+{
+    if (!seg->coalesced) return 1;
+    int nRuns = 0;
+    while (seg->runs[nRuns].numFrames > 0) nRuns++;
+    return nRuns;
+}
+
+static void CopyRuns(Segment* seg, SegmentRun* dest)
+{
+    if (!seg->coalesced) {
+        dest[0].seed = seg->seed;
+        dest[0].numFrames = seg->numFrames;
+    }
+    else memcpy(dest, seg->runs, CountRuns(seg) * sizeof(SegmentRun));
+}
+
+// Folds each segment that ends no block and has a single child into that child, which
+// replays both runs in turn. Combined segments stay within MaxSegmentLength frames, so a
+// chain still holds at most MaxSegments * MaxSegmentLength frames, as m64Diff allows,
+// while its depth drops. Depths are recomputed for all segments afterwards. Runs at GC,
+// after the sweep, when every segment is in the shared list and no shot is in flight.
+int GlobalState::CoalesceSegments()
+{
+    int sharedStart = config.TotalThreads * config.MaxLocalSegments;
+    Segment** segs = AllSegments + sharedStart;
+    const uint32_t absorbed = 0xFFFFFFFF;
+
+    // refCount becomes twice the number of children, plus one if some block ends here.
+    for (int segInd = 0; segInd < NSegments[config.TotalThreads]; segInd++)
+        segs[segInd]->refCount = 0;
+    for (int segInd = 0; segInd < NSegments[config.TotalThreads]; segInd++) {
+        if (segs[segInd]->parent != 0) segs[segInd]->parent->refCount += 2;
+    }
+    for (int blockInd = 0; blockInd < NBlocks[config.TotalThreads]; blockInd++)
+        SharedBlocks[blockInd].tailSeg->refCount |= 1;
+
+    // Every run of pass-through segments ends in exactly one segment that is not one, so
+    // starting from those reaches each pass-through segment once.
+    int nCoalesced = 0;
+    for (int segInd = 0; segInd < NSegments[config.TotalThreads]; segInd++) {
+        Segment* seg = segs[segInd];
+        if (seg->refCount == 2) continue;
+
+        while (seg->parent != 0 && seg->parent->refCount == 2) {
+            Segment* pass = seg->parent;
+            if (pass->numFrames + seg->numFrames > config.MaxSegmentLength) {
+                seg = pass;
+                continue;
+            }
+
+            int nPass = CountRuns(pass), nSeg = CountRuns(seg);
+            SegmentRun* runs = (SegmentRun*)malloc((nPass + nSeg + 1) * sizeof(SegmentRun));
+            CopyRuns(pass, runs);
+            CopyRuns(seg, runs + nPass);
+            runs[nPass + nSeg].numFrames = 0;
+            if (seg->coalesced) free(seg->runs);
+            seg->runs = runs;
+            seg->coalesced = 1;
+            seg->numFrames += pass->numFrames;
+            seg->parent = pass->parent;
+            pass->refCount = absorbed;
+            nCoalesced++;
+        }
+    }
+    if (nCoalesced == 0) return 0;
+
+    for (int segInd = 0; segInd < NSegments[config.TotalThreads]; segInd++) {
+        Segment* curSeg = segs[segInd];
+        if (curSeg->refCount == absorbed) {
+            segs[segInd] = segs[NSegments[config.TotalThreads] - 1];
+            NSegments[config.TotalThreads]--;
+            segInd--;
+            FreeSegment(curSeg);
         }
     }
 
-    printf("Segment garbage collection finished. Ended with %d segments\n", NSegments[config.TotalThreads]);
+    // Walk up to the nearest segment whose depth is known, then down again numbering the
+    // path, so each segment is numbered once.
+    for (int segInd = 0; segInd < NSegments[config.TotalThreads]; segInd++)
+        segs[segInd]->depth = 0;
+    for (int segInd = 0; segInd < NSegments[config.TotalThreads]; segInd++) {
+        int pathLength = 0;
+        Segment* curSeg = segs[segInd];
+        for (; curSeg != 0 && curSeg->depth == 0; curSeg = curSeg->parent)
+            pathLength++;
+        int depth = (curSeg != 0 ? curSeg->depth : 0) + pathLength;
+        for (curSeg = segs[segInd]; pathLength > 0; pathLength--, curSeg = curSeg->parent)
+            curSeg->depth = depth--;
+    }
+
+    return nCoalesced;
 }
 
-void GlobalState::MergeState(int mainIteration)
+typedef struct {
+    int inx;
+    int rank;  // 0: failed, shot at without yield or cannot be extended, 1: never shot at, 2: has yielded
+    float value;
+} EvictCandidate;
+
+static int CompareEvictCandidates(const void* a, const void* b)
 {
+    const EvictCandidate* x = (const EvictCandidate*)a;
+    const EvictCandidate* y = (const EvictCandidate*)b;
+    if (x->rank != y->rank) return x->rank - y->rank;
+    if (x->value != y->value) return x->value < y->value ? -1 : 1;
+    return x->inx - y->inx;
+}
+
+// Keeps the shared tables under their budgets. Once either blocks or segments are past
+// EvictHighWatermark it drops leaf blocks (no live segment extends their tail, so nothing
+// depends on them) down to EvictLowWatermark: first those that were shot at without
+// yielding anything, then those never shot at, then the rest, lowest value first within
+// each group. A leaf's tail is its own, so each eviction frees at least one segment at
+// the next GC. The root is never evicted. Runs after MergeSegments, when every segment
+// is in the shared list.
+int GlobalState::EvictBlocks()
+{
+    int nShared = NBlocks[config.TotalThreads];
+    if (nShared <= config.EvictHighWatermark * config.MaxSharedBlocks
+        && NSegments[config.TotalThreads] <= config.EvictHighWatermark * config.MaxSharedSegments)
+        return 0;
+
+    // Mark the live segments as GC does, then give each one 2 per live child. Chains
+    // left behind by superseded blocks are dead and do not keep their base from being a leaf.
+    int sharedStart = config.TotalThreads * config.MaxLocalSegments;
+    for (int segInd = sharedStart; segInd < sharedStart + NSegments[config.TotalThreads]; segInd++)
+        AllSegments[segInd]->refCount = 0;
+    for (int blockInd = 0; blockInd < nShared; blockInd++) {
+        Segment* curSeg = SharedBlocks[blockInd].tailSeg;
+        while (curSeg != 0 && curSeg->refCount++ == 0)
+            curSeg = curSeg->parent;
+    }
+    int nLive = 0;
+    for (int segInd = sharedStart; segInd < sharedStart + NSegments[config.TotalThreads]; segInd++) {
+        if (AllSegments[segInd]->refCount == 0) continue;
+        AllSegments[segInd]->refCount = 1;
+        nLive++;
+    }
+    for (int segInd = sharedStart; segInd < sharedStart + NSegments[config.TotalThreads]; segInd++) {
+        Segment* seg = AllSegments[segInd];
+        if (seg->refCount != 0 && seg->parent != 0) seg->parent->refCount += 2;
+    }
+
+    EvictCandidate* candidates = (EvictCandidate*)malloc(nShared * sizeof(EvictCandidate));
+    int nCandidates = 0;
+    for (int blockInd = 1; blockInd < nShared; blockInd++) {
+        Block& block = SharedBlocks[blockInd];
+        if (block.tailSeg->refCount >= 2) continue;
+
+        BlockStats& stats = SharedStats[blockInd];
+        EvictCandidate& candidate = candidates[nCandidates++];
+        candidate.inx = blockInd;
+        candidate.value = block.value;
+        if (Failing(blockInd)) candidate.rank = 0;
+        else if (stats.discoveries + stats.improvements > 0) candidate.rank = 2;
+        else if (stats.shots > 0 || block.tailSeg->depth >= config.MaxSegments) candidate.rank = 0;
+        else candidate.rank = 1;
+    }
+    qsort(candidates, nCandidates, sizeof(EvictCandidate), CompareEvictCandidates);
+
+    int nEvict = nShared - (int)(config.EvictLowWatermark * config.MaxSharedBlocks);
+    int segmentExcess = nLive - (int)(config.EvictLowWatermark * config.MaxSharedSegments);
+    if (nEvict < segmentExcess) nEvict = segmentExcess;
+    if (nEvict < 0) nEvict = 0;
+    if (nEvict > nCandidates) nEvict = nCandidates;
+    if (nEvict == 0) {
+        free(candidates);
+        return 0;
+    }
+
+    char* evict = (char*)calloc(nShared, 1);
+    for (int n = 0; n < nEvict; n++)
+        evict[candidates[n].inx] = 1;
+    RemoveBlocks(evict);
+
+    free(evict);
+    free(candidates);
+
+    EvictedBlocks += nEvict;
+    printer.printfQ("Evicted %d of %d shared blocks (%d leaves)\n", nEvict, nShared, nCandidates);
+    return nEvict;
+}
+
+// Compacts the shared table over the blocks not flagged in remove, keeping order, and
+// rebuilds the hash table and the top-K list over the survivors.
+void GlobalState::RemoveBlocks(char* remove)
+{
+    int nShared = NBlocks[config.TotalThreads];
+    int kept = 0;
+    for (int blockInd = 0; blockInd < nShared; blockInd++) {
+        if (remove[blockInd]) {
+            BlockStats& stats = SharedStats[blockInd];
+            if (stats.shots >= (uint32_t)config.RetireAfterShots && stats.discoveries + stats.improvements == 0) RetiredBlocks--;
+            continue;
+        }
+        SharedBlocks[kept] = SharedBlocks[blockInd];
+        SharedStats[kept] = SharedStats[blockInd];
+        kept++;
+    }
+    memset(SharedStats + kept, 0, (nShared - kept) * sizeof(BlockStats));
+    NBlocks[config.TotalThreads] = kept;
+
+    memset(SharedHashTab, 0xFF, config.MaxSharedHashes * sizeof(int));
+    for (int blockInd = 0; blockInd < kept; blockInd++) {
+        int hashInx = SharedBlocks[blockInd].pos.findNewHashInx(SharedHashTab, config.MaxSharedHashes);
+        if (hashInx >= 0) SharedHashTab[hashInx] = blockInd;
+    }
+
+    Top.Rebuild(SharedBlocks, kept);
+}
+
+// Set on BlockStats::failures while MergeStats goes through the shot logs.
+static const uint32_t FailuresCleared = 0x80000000;
+
+// Must run before MergeBlocks: shot logs refer to shared indices from the previous epoch.
+void GlobalState::MergeStats()
+{
+    EpochStats& epoch = Tuning.Epoch;
+    epoch.shots = epoch.frames = epoch.replayFrames = 0;
+    memset(epoch.strategyFrames, 0, sizeof(epoch.strategyFrames));
+    epoch.spilledBlocks = epoch.newBlocks = 0;
+    epoch.sharedSegmentFill = (float)NSegments[config.TotalThreads] / config.MaxSharedSegments;
+    SpilledBlocks = SpilledSegments = 0;
+    ShotRecord* bestShot = NULL;
+
+    for (int tid = 0; tid < config.TotalThreads; tid++) {
+        for (int b = 0; b < Spills[tid].nBuffers; b++)
+            epoch.spilledBlocks += Spills[tid].bufferBlocks[b];
+        SpilledBlocks += Spills[tid].spilledBlocks;
+        SpilledSegments += Spills[tid].spilledSegments;
+
+        for (int n = 0; n < NShots[tid]; n++) {
+            ShotRecord& shot = ShotLogs[tid][n];
+            BlockStats& stats = SharedStats[shot.baseInx];
+            stats.shots++;
+            stats.discoveries += shot.discoveries;
+            stats.improvements += shot.improvements;
+            // Flag a success for the second pass, which clears the failures.
+            stats.failures += shot.failed;
+            if (!shot.failed) stats.failures |= FailuresCleared;
+            stats.exits += shot.exits;
+            stats.exitFrames += shot.exitFrames;
+
+            if (stats.shots == config.RetireAfterShots && stats.discoveries + stats.improvements == 0)
+                RetiredBlocks++;
+
+            PolicyShots[shot.policy]++;
+            PolicyYield[shot.policy] += shot.discoveries + shot.improvements;
+            PolicyFrames[shot.policy] += shot.frames;
+            StrategyShots[shot.strategy]++;
+            StrategyDiscoveries[shot.strategy] += shot.discoveries;
+            if (!bestShot || shot.bestValue > bestShot->bestValue) bestShot = &shot;
+            Branches += shot.branches;
+            TotalShots++;
+            if (Novelty.Enabled()) {
+                Novelty.FramesRun += shot.frames - shot.replayFrames;
+                Novelty.FramesSaved += shot.framesSaved;
+                Novelty.Checks += shot.noveltyChecks;
+                Novelty.Hits += shot.noveltyHits;
+            }
+
+            epoch.shots++;
+            epoch.frames += shot.frames;
+            epoch.replayFrames += shot.replayFrames;
+            epoch.strategyFrames[shot.strategy] += shot.frames;
+        }
+    }
+
+    // MergeBlocks has yet to run, so Top still holds the previous best.
+    float bestBefore = Top.Count > 0 ? Top.Value[0] : 0;
+    if (bestShot && bestShot->bestValue > bestBefore)
+        StrategyGain[bestShot->strategy] += bestShot->bestValue - bestBefore;
+
+    // Age the exit samples and clear the failures of blocks some shot reproduced once all
+    // shots are in, so that the result does not depend on the order they were logged in.
+    for (int tid = 0; tid < config.TotalThreads; tid++) {
+        for (int n = 0; n < NShots[tid]; n++) {
+            BlockStats& stats = SharedStats[ShotLogs[tid][n].baseInx];
+            if (stats.failures & FailuresCleared) stats.failures = 0;
+            while (stats.exits > ExitWindow) {
+                stats.exits /= 2;
+                stats.exitFrames /= 2;
+            }
+        }
+        NShots[tid] = 0;
+    }
+
+    MergeCount++;
+    ActivePolicy = config.SelectionPolicy == POLICY_ALTERNATE ? MergeCount % 2 : config.SelectionPolicy;
+    Sampler.Weight = ActivePolicy == POLICY_UCB ? BlockSampler::UcbWeight : BlockSampler::NormWeight;
+    ActiveStrategy = config.Strategy == STRATEGY_ROTATE ? MergeCount / config.StrategyMerges % STRATEGY_COUNT : config.Strategy;
+}
+
+void GlobalState::MergeState()
+{
+    double timerStart = omp_get_wtime();
+    MergeStats();
+    Bins.Update(*this);
+
+    if (Novelty.Enabled() && Novelty.EstimatedFalsePositiveRate() > config.NoveltyMaxFalsePositive) {
+        Novelty.Clear();
+        Novelty.Clears++;
+    }
+
     // Merge all blocks from all threads and redistribute info.
     MergeBlocks();
+    Bins.Fold(*this);
 
     // Handle segments
     MergeSegments();
 
-    if (mainIteration % (config.ShotsPerMerge * config.MergesPerSegmentGC) == 0)
+    // Evicted blocks leave dead segment chains, so collect them right away.
+    LastEvicted = EvictBlocks();
+
+    double gcTime = 0;
+    if (SegmentGCDue() || LastEvicted > 0 || NSegments[config.TotalThreads] > config.EvictHighWatermark * config.MaxSharedSegments) {
+        double gcStart = omp_get_wtime();
         SegmentGarbageCollection();
+        gcTime = omp_get_wtime() - gcStart;
+        MergesSinceGC = 0;
+    }
+    else {
+        MergesSinceGC++;
+    }
+
+    BuildLightning();
+    Search.Rebuild(*this);
+
+    if (config.Deterministic)
+        printer.printfQ("DIGEST merge %d blocks %d %016llx\n", MergeCount, NBlocks[config.TotalThreads], (unsigned long long)Digest());
+
+    Tuning.Update(*this, timerStart, gcTime);
+
+    // Shots that found no base of the epoch's strategy fell back to scattershot, so the
+    // epoch's thread time goes to each strategy by the frames its shots ran.
+    EpochStats& epoch = Tuning.Epoch;
+    if (epoch.epochTime > 0 && epoch.frames > 0) {
+        for (int strategy = 0; strategy < STRATEGY_COUNT; strategy++)
+            StrategyTime[strategy] += epoch.epochTime * config.TotalThreads * epoch.strategyFrames[strategy] / epoch.frames;
+    }
+}
+
+// Lists the blocks along the chains of the LightningPaths best blocks, walking each chain
+// up to where it joins one already listed, so that SelectBaseBlock can draw a block on
+// the best trajectories in constant time. A segment stands for the block that ends on it,
+// if any, and only extendable blocks are listed. Runs last in MergeState: eviction and GC are done with refCount by then, and
+// it is not read again before the next merge, so it holds the block index here.
+void GlobalState::BuildLightning()
+{
+    LightningLength = 0;
+    LightningPaths = config.LightningPaths < Top.Count ? config.LightningPaths : Top.Count;
+    if (LightningPaths <= 0) return;
+
+    const uint32_t listed = 0xFFFFFFFF;
+    int sharedStart = config.TotalThreads * config.MaxLocalSegments;
+    for (int segInd = sharedStart; segInd < sharedStart + NSegments[config.TotalThreads]; segInd++)
+        AllSegments[segInd]->refCount = 0;
+    for (int blockInd = 0; blockInd < NBlocks[config.TotalThreads]; blockInd++)
+        SharedBlocks[blockInd].tailSeg->refCount = blockInd + 1;
+
+    for (int rank = 0; rank < LightningPaths; rank++) {
+        for (Segment* curSeg = SharedBlocks[Top.Inx[rank]].tailSeg; curSeg != 0 && curSeg->refCount != listed; curSeg = curSeg->parent) {
+            if (curSeg->refCount == 0 || !Extendable(curSeg->refCount - 1)) continue;
+            if (LightningLength == config.MaxLightningLength) {
+                Printer::Warn(WARN_MAX_LIGHTNING);
+                return;
+            }
+            Lightning[LightningLength++] = curSeg->refCount - 1;
+            curSeg->refCount = listed;
+        }
+    }
+}
+
+// FNV-1a over the shared table in index order. Chains enter through their tail segment's
+// depth, seed and length rather than through pointers, so two runs that built the same
+// table print the same digest.
+uint64_t GlobalState::Digest()
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (int blockInd = 0; blockInd < NBlocks[config.TotalThreads]; blockInd++) {
+        Block& block = SharedBlocks[blockInd];
+        uint64_t fields[6] = { (uint64_t)block.pos.x | (uint64_t)block.pos.y << 8 | (uint64_t)block.pos.z << 16, block.pos.s, 0,
+            block.tailSeg->lastSeed(), block.tailSeg->depth, block.tailSeg->numFrames };
+        memcpy(&fields[2], &block.value, sizeof(float));
+        const uint8_t* bytes = (const uint8_t*)fields;
+        for (int n = 0; n < (int)sizeof(fields); n++) {
+            hash ^= bytes[n];
+            hash *= 1099511628211ULL;
+        }
+    }
+    return hash;
 }
\ No newline at end of file
@@ -0,0 +1,227 @@
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <Snapshot.hpp>
+
+// scattershot_inspect: reads the snapshot a running scattershot publishes (Snapshot.hpp)
+// and answers queries about it without touching the search.
+//
+//   scattershot_inspect <pid> [summary]        Table occupancy and shot totals
+//   scattershot_inspect <pid> top [n]          The n best blocks
+//   scattershot_inspect <pid> depth [width]    Chain depth distribution
+//   scattershot_inspect <pid> heatmap [xz]     Blocks per spatial bin, over two of x, y, z
+//
+// A run hosting several targets publishes one snapshot each; <pid>:<n> picks target n.
+
+typedef struct {
+    uint64_t sequence;
+    int capacity;
+    int nBlocks;
+    int merge;
+    int nSegments;
+    long long totalShots;
+    double runTime;
+} SnapshotInfo;
+
+static SnapshotInfo Info;
+static SnapshotBlock* Blocks = NULL;
+
+// Seqlock read: copy, then check that no publish started or finished meanwhile.
+static bool ReadSnapshot(SnapshotHeader* shared)
+{
+    SnapshotBlock* records = (SnapshotBlock*)(shared + 1);
+    int capacity = 0;
+
+    for (int attempt = 0; attempt < 1000; attempt++) {
+        uint64_t sequence = shared->sequence.load(std::memory_order_acquire);
+        if (sequence & 1) {
+            Sleep(1);
+            continue;
+        }
+
+        Info.capacity = shared->capacity;
+        Info.nBlocks = shared->nBlocks;
+        Info.merge = shared->merge;
+        Info.nSegments = shared->nSegments;
+        Info.totalShots = shared->totalShots;
+        Info.runTime = shared->runTime;
+        if (Info.nBlocks < 0 || Info.nBlocks > Info.capacity)
+            continue;
+        if (Info.nBlocks > capacity) {
+            capacity = Info.nBlocks;
+            Blocks = (SnapshotBlock*)realloc(Blocks, capacity * sizeof(SnapshotBlock));
+        }
+        memcpy(Blocks, records, Info.nBlocks * sizeof(SnapshotBlock));
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (shared->sequence.load(std::memory_order_relaxed) == sequence) {
+            Info.sequence = sequence;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void Summary()
+{
+    int failed = 0, unshot = 0, yielded = 0, best = -1;
+    long long shots = 0;
+    for (int n = 0; n < Info.nBlocks; n++) {
+        SnapshotBlock& block = Blocks[n];
+        if (block.failed) failed++;
+        if (block.shots == 0) unshot++;
+        if (block.discoveries + block.improvements > 0) yielded++;
+        shots += block.shots;
+        if (best < 0 || block.value > Blocks[best].value) best = n;
+    }
+
+    printf("merge %d, %.1f s, snapshot %llu\n", Info.merge, Info.runTime, (unsigned long long)(Info.sequence / 2));
+    printf("blocks %d of %d (%.2f%%), segments %d\n", Info.nBlocks, Info.capacity,
+        Info.capacity ? 100.0 * Info.nBlocks / Info.capacity : 0.0, Info.nSegments);
+    printf("shots %lld, %.2f per block; never shot %d, yielded %d, failed %d\n",
+        Info.totalShots, Info.nBlocks ? (double)shots / Info.nBlocks : 0.0, unshot, yielded, failed);
+    if (best >= 0)
+        printf("best %f at %d %d %d %llu, depth %d\n", Blocks[best].value,
+            Blocks[best].x, Blocks[best].y, Blocks[best].z, (unsigned long long)Blocks[best].s, Blocks[best].depth);
+}
+
+static int CompareValueDesc(const void* a, const void* b)
+{
+    float va = ((const SnapshotBlock*)a)->value, vb = ((const SnapshotBlock*)b)->value;
+    return va > vb ? -1 : va < vb ? 1 : 0;
+}
+
+static void Top(int count)
+{
+    qsort(Blocks, Info.nBlocks, sizeof(SnapshotBlock), CompareValueDesc);
+    if (count > Info.nBlocks) count = Info.nBlocks;
+
+    printf("%5s %12s %4s %4s %4s %20s %5s %6s %6s %6s\n", "rank", "value", "x", "y", "z", "s", "depth", "shots", "disc", "impr");
+    for (int rank = 0; rank < count; rank++) {
+        SnapshotBlock& block = Blocks[rank];
+        printf("%5d %12f %4d %4d %4d %20llu %5d %6u %6u %6u%s\n", rank, block.value, block.x, block.y, block.z,
+            (unsigned long long)block.s, block.depth, block.shots, block.discoveries, block.improvements, block.failed ? " failed" : "");
+    }
+}
+
+static void Depth(int width)
+{
+    int maxDepth = 0;
+    for (int n = 0; n < Info.nBlocks; n++)
+        if (Blocks[n].depth > maxDepth) maxDepth = Blocks[n].depth;
+
+    int nBuckets = maxDepth / width + 1;
+    int* counts = (int*)calloc(nBuckets, sizeof(int));
+    int maxCount = 0;
+    for (int n = 0; n < Info.nBlocks; n++) {
+        int& count = counts[Blocks[n].depth / width];
+        if (++count > maxCount) maxCount = count;
+    }
+
+    for (int bucket = 0; bucket < nBuckets; bucket++) {
+        int bar = maxCount ? (int)(60.0 * counts[bucket] / maxCount + 0.5) : 0;
+        printf("%5d-%-5d %9d %.*s\n", bucket * width, (bucket + 1) * width - 1, counts[bucket], bar,
+            "############################################################");
+    }
+    free(counts);
+}
+
+static uint8_t Coord(SnapshotBlock& block, char axis)
+{
+    return axis == 'x' ? block.x : axis == 'y' ? block.y : block.z;
+}
+
+// Rows follow the first axis and columns the second, cropped to the occupied bins. Shades
+// go up logarithmically with the number of blocks in the bin, all partition levels included.
+static void Heatmap(const char* axes)
+{
+    static const char shades[] = " .:-=+*#%@";
+    int* counts = (int*)calloc(256 * 256, sizeof(int));
+    int lo[2] = { 255, 255 }, hi[2] = { 0, 0 }, maxCount = 0;
+    for (int n = 0; n < Info.nBlocks; n++) {
+        int a = Coord(Blocks[n], axes[0]), b = Coord(Blocks[n], axes[1]);
+        int& count = counts[a * 256 + b];
+        if (++count > maxCount) maxCount = count;
+        if (a < lo[0]) lo[0] = a;
+        if (a > hi[0]) hi[0] = a;
+        if (b < lo[1]) lo[1] = b;
+        if (b > hi[1]) hi[1] = b;
+    }
+    if (maxCount == 0) {
+        free(counts);
+        return;
+    }
+
+    printf("%c %d-%d down, %c %d-%d across, '%c' = %d blocks\n", axes[0], lo[0], hi[0], axes[1], lo[1], hi[1], shades[9], maxCount);
+    for (int a = lo[0]; a <= hi[0]; a++) {
+        printf("%4d ", a);
+        for (int b = lo[1]; b <= hi[1]; b++) {
+            int count = counts[a * 256 + b];
+            int shade = count == 0 ? 0 : maxCount == 1 ? 9 : 1 + (int)(8 * log((double)count) / log((double)maxCount));
+            putchar(shades[shade]);
+        }
+        putchar('\n');
+    }
+    free(counts);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        printf("Usage: %s <pid>[:<target>] [summary | top [n] | depth [width] | heatmap [xy|xz|yz]]\n", argv[0]);
+        return 1;
+    }
+
+    char name[64];
+    char* end;
+    unsigned long pid = strtoul(argv[1], &end, 10);
+    int target = *end == ':' ? atoi(end + 1) : 0;
+    if (target == 0)
+        sprintf(name, SNAPSHOT_NAME_FORMAT, pid);
+    else
+        sprintf(name, SNAPSHOT_TARGET_NAME_FORMAT, pid, target);
+    HANDLE mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, name);
+    if (!mapping) {
+        printf("No snapshot at %s (error %lu)\n", name, GetLastError());
+        return 1;
+    }
+    SnapshotHeader* shared = (SnapshotHeader*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!shared || memcmp(shared->magic, "SSSN", 4) != 0 || shared->version != SnapshotVersion) {
+        printf("%s is not a version %u snapshot\n", name, SnapshotVersion);
+        return 1;
+    }
+    if (!ReadSnapshot(shared)) {
+        printf("Snapshot kept changing, try again\n");
+        return 1;
+    }
+    if (Info.sequence == 0) {
+        printf("Nothing published yet\n");
+        return 0;
+    }
+
+    const char* query = argc > 2 ? argv[2] : "summary";
+    if (strcmp(query, "summary") == 0)
+        Summary();
+    else if (strcmp(query, "top") == 0)
+        Top(argc > 3 ? atoi(argv[3]) : 20);
+    else if (strcmp(query, "depth") == 0)
+        Depth(argc > 3 && atoi(argv[3]) > 0 ? atoi(argv[3]) : 16);
+    else if (strcmp(query, "heatmap") == 0) {
+        const char* axes = argc > 3 ? argv[3] : "xz";
+        if (strlen(axes) != 2 || !strchr("xyz", axes[0]) || !strchr("xyz", axes[1]) || axes[0] == axes[1]) {
+            printf("heatmap takes two of x, y, z\n");
+            return 1;
+        }
+        Heatmap(axes);
+    }
+    else {
+        printf("Unknown query %s\n", query);
+        return 1;
+    }
+
+    UnmapViewOfFile(shared);
+    CloseHandle(mapping);
+    return 0;
+}
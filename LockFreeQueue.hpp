@@ -0,0 +1,87 @@
+#pragma once
+#include <atomic>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifndef LOCKFREEQUEUE_H
+#define LOCKFREEQUEUE_H
+
+// Bounded multi-producer/multi-consumer ring (Vyukov). Each cell carries a sequence
+// number that tells producers and consumers whose turn it is, so neither side locks.
+// Capacity is rounded up to a power of two.
+template <typename T>
+class LockFreeQueue
+{
+public:
+    LockFreeQueue(int capacity)
+    {
+        size_t size = 2;
+        while (size < (size_t)capacity) size <<= 1;
+        mask = size - 1;
+        cells = new Cell[size];
+        for (size_t i = 0; i < size; i++)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        enqueuePos.store(0, std::memory_order_relaxed);
+        dequeuePos.store(0, std::memory_order_relaxed);
+    }
+
+    ~LockFreeQueue()
+    {
+        delete[] cells;
+    }
+
+    LockFreeQueue(const LockFreeQueue&) = delete;
+    LockFreeQueue& operator=(const LockFreeQueue&) = delete;
+
+    bool TryPush(const T& item)
+    {
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell* cell = &cells[pos & mask];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell->data = item;
+                    cell->sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0) return false; // Full
+            else pos = enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    bool TryPop(T& item)
+    {
+        size_t pos = dequeuePos.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell* cell = &cells[pos & mask];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    item = cell->data;
+                    cell->sequence.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0) return false; // Empty
+            else pos = dequeuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    Cell* cells;
+    size_t mask;
+    alignas(64) std::atomic<size_t> enqueuePos;
+    alignas(64) std::atomic<size_t> dequeuePos;
+};
+
+#endif
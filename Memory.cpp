@@ -0,0 +1,284 @@
+#include <Memory.hpp>
+#include <Utils.hpp>
+
+int Memory::NumNodes = 1;
+int Memory::NumCores = 0;
+int Memory::NumCpus = 0;
+int Memory::NumThreads = 0;
+LogicalCpu* Memory::ThreadCpus = NULL;
+int Memory::LargePages = LARGE_PAGES_OFF;
+size_t Memory::LargePageSize = 0;
+std::atomic<long long> Memory::LargeAllocs{ 0 };
+std::atomic<long long> Memory::LargeBytes{ 0 };
+std::atomic<long long> Memory::SmallAllocs{ 0 };
+std::atomic<long long> Memory::SmallBytes{ 0 };
+
+static int* nodeIds = NULL;  // NUMA node numbers, for round-robin interleaving
+
+typedef struct {
+    LogicalCpu cpu;
+    int rank;  // Position of the core among the cores of its node
+} PlacedCpu;
+
+static int CompareCpus(const void* a, const void* b)
+{
+    const PlacedCpu* x = (const PlacedCpu*)a;
+    const PlacedCpu* y = (const PlacedCpu*)b;
+    if (x->cpu.sibling != y->cpu.sibling) return x->cpu.sibling - y->cpu.sibling;
+    if (x->rank != y->rank) return x->rank - y->rank;
+    return x->cpu.node - y->cpu.node;
+}
+
+void Memory::Init(int nThreads)
+{
+    NumThreads = nThreads;
+
+    DWORD length = 0;
+    GetLogicalProcessorInformationEx(RelationAll, NULL, &length);
+    if (length == 0) return;
+
+    char* buffer = (char*)malloc(length);
+    if (!GetLogicalProcessorInformationEx(RelationAll, (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)buffer, &length)) {
+        free(buffer);
+        return;
+    }
+
+    // First pass: nodes, and the number of logical processors.
+    int nNodes = 0, nCpus = 0;
+    for (DWORD off = 0; off < length; off += ((PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)(buffer + off))->Size) {
+        PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX info = (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)(buffer + off);
+        if (info->Relationship == RelationNumaNode) nNodes++;
+        if (info->Relationship == RelationProcessorCore) {
+            for (int g = 0; g < info->Processor.GroupCount; g++) {
+                for (KAFFINITY mask = info->Processor.GroupMask[g].Mask; mask; mask &= mask - 1)
+                    nCpus++;
+            }
+        }
+    }
+    if (nCpus == 0) {
+        free(buffer);
+        return;
+    }
+
+    GROUP_AFFINITY* nodeMasks = (GROUP_AFFINITY*)calloc(nNodes + 1, sizeof(GROUP_AFFINITY));
+    nodeIds = (int*)calloc(nNodes + 1, sizeof(int));
+    int* coresOnNode = (int*)calloc(nNodes + 1, sizeof(int));
+    PlacedCpu* cpus = (PlacedCpu*)calloc(nCpus, sizeof(PlacedCpu));
+
+    int n = 0;
+    for (DWORD off = 0; off < length; off += ((PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)(buffer + off))->Size) {
+        PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX info = (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)(buffer + off);
+        if (info->Relationship == RelationNumaNode) {
+            nodeMasks[n] = info->NumaNode.GroupMask;
+            nodeIds[n++] = (int)info->NumaNode.NodeNumber;
+        }
+    }
+
+    // Second pass: place every logical processor of every core.
+    int nPlaced = 0, core = 0;
+    for (DWORD off = 0; off < length; off += ((PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)(buffer + off))->Size) {
+        PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX info = (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)(buffer + off);
+        if (info->Relationship != RelationProcessorCore) continue;
+
+        int sibling = 0, nodeInx = 0, rank = 0;
+        for (int g = 0; g < info->Processor.GroupCount; g++) {
+            GROUP_AFFINITY& affinity = info->Processor.GroupMask[g];
+            for (int bit = 0; bit < 64; bit++) {
+                KAFFINITY bitMask = (KAFFINITY)1 << bit;
+                if (!(affinity.Mask & bitMask)) continue;
+
+                if (sibling == 0) {
+                    for (int i = 0; i < nNodes; i++) {
+                        if (nodeMasks[i].Group == affinity.Group && (nodeMasks[i].Mask & bitMask)) nodeInx = i;
+                    }
+                    rank = coresOnNode[nodeInx]++;
+                }
+
+                PlacedCpu& placed = cpus[nPlaced++];
+                placed.cpu.group = affinity.Group;
+                placed.cpu.number = (BYTE)bit;
+                placed.cpu.node = nodeIds[nodeInx];
+                placed.cpu.core = core;
+                placed.cpu.sibling = sibling++;
+                placed.rank = rank;
+            }
+        }
+        core++;
+    }
+
+    qsort(cpus, nPlaced, sizeof(PlacedCpu), CompareCpus);
+
+    NumNodes = nNodes > 0 ? nNodes : 1;
+    NumCores = core;
+    NumCpus = nPlaced;
+    ThreadCpus = (LogicalCpu*)calloc(nThreads, sizeof(LogicalCpu));
+    for (int tid = 0; tid < nThreads; tid++)
+        ThreadCpus[tid] = cpus[tid % nPlaced].cpu;
+
+    free(cpus);
+    free(coresOnNode);
+    free(nodeMasks);
+    free(buffer);
+}
+
+void Memory::ReportPlacement(Printer& printer)
+{
+    if (!ThreadCpus) {
+        printer.printfQ("Processor topology unavailable, threads are not pinned\n");
+        return;
+    }
+
+    printer.printfQ("NUMA nodes %d, cores %d, logical processors %d\n", NumNodes, NumCores, NumCpus);
+    for (int tid = 0; tid < NumThreads; tid++) {
+        LogicalCpu& cpu = ThreadCpus[tid];
+        printer.printfQ("Thread %d -> group %d cpu %d node %d core %d%s\n",
+            tid, cpu.group, cpu.number, cpu.node, cpu.core, cpu.sibling ? " (SMT sibling)" : "");
+    }
+    if (NumThreads > NumCpus)
+        printer.printfQ("More threads than logical processors, some share a processor\n");
+    if (NumNodes > 1 && LargePages != LARGE_PAGES_OFF)
+        printer.printfQ("Thread tables on the thread's node, shared tables on large pages (not interleaved)\n");
+    else if (NumNodes > 1)
+        printer.printfQ("Thread tables on the thread's node, shared tables interleaved in %d KB chunks\n", (int)(InterleaveChunk >> 10));
+    else
+        printer.printfQ("Single NUMA node, no placement needed\n");
+}
+
+bool Memory::PinCurrentThread(int tid)
+{
+    if (!ThreadCpus) return true;
+
+    LogicalCpu& cpu = ThreadCpus[tid];
+    GROUP_AFFINITY affinity = {};
+    affinity.Mask = (KAFFINITY)1 << cpu.number;
+    affinity.Group = cpu.group;
+    if (!SetThreadGroupAffinity(GetCurrentThread(), &affinity, NULL))
+        return false;
+
+    PROCESSOR_NUMBER ideal = {};
+    ideal.Group = cpu.group;
+    ideal.Number = cpu.number;
+    SetThreadIdealProcessorEx(GetCurrentThread(), &ideal, NULL);
+    return true;
+}
+
+bool Memory::SetLargePagePolicy(int policy, Printer& printer)
+{
+    LargePages = policy;
+    if (policy == LARGE_PAGES_OFF) return true;
+
+    LargePageSize = GetLargePageMinimum();
+
+    HANDLE token;
+    bool granted = false;
+    if (LargePageSize > 0 && OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) {
+        TOKEN_PRIVILEGES privileges = {};
+        privileges.PrivilegeCount = 1;
+        privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+        if (LookupPrivilegeValueA(NULL, SE_LOCK_MEMORY_NAME, &privileges.Privileges[0].Luid)) {
+            // AdjustTokenPrivileges succeeds even if the privilege was not assigned to the account.
+            granted = AdjustTokenPrivileges(token, FALSE, &privileges, 0, NULL, NULL) && GetLastError() != ERROR_NOT_ALL_ASSIGNED;
+        }
+        CloseHandle(token);
+    }
+
+    if (granted) {
+        printer.printfQ("Large pages enabled, %d KB pages\n", (int)(LargePageSize >> 10));
+        return true;
+    }
+
+    LargePages = LARGE_PAGES_OFF;
+    printer.printfQ("Large pages unavailable (%s)%s\n",
+        LargePageSize == 0 ? "not supported" : "SeLockMemoryPrivilege not held",
+        policy == LARGE_PAGES_REQUIRE ? "" : ", using 4 KB pages");
+    return policy != LARGE_PAGES_REQUIRE;
+}
+
+void Memory::ReportLargePages(Printer& printer)
+{
+    long long largeBytes = LargeBytes, smallBytes = SmallBytes;
+    printer.printfQ("MEMORY large pages %lld allocations %.1f MB (%lld pages), small pages %lld allocations %.1f MB\n",
+        LargeAllocs.load(), largeBytes / 1048576.0, LargePageSize ? largeBytes / (long long)LargePageSize : 0,
+        SmallAllocs.load(), smallBytes / 1048576.0);
+}
+
+int Memory::CurrentNode()
+{
+    if (NumNodes <= 1) return -1;
+
+    PROCESSOR_NUMBER processor;
+    USHORT node;
+    GetCurrentProcessorNumberEx(&processor);
+    return GetNumaProcessorNodeEx(&processor, &node) ? node : -1;
+}
+
+void* Memory::AllocLarge(size_t bytes, int node)
+{
+    if (LargePages == LARGE_PAGES_OFF) return NULL;
+
+    void* ptr;
+    size_t largeBytes = (bytes + LargePageSize - 1) / LargePageSize * LargePageSize;
+    if (node >= 0 && NumNodes > 1)
+        ptr = VirtualAllocExNuma(GetCurrentProcess(), NULL, largeBytes, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE, node);
+    else
+        ptr = VirtualAlloc(NULL, largeBytes, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+
+    if (ptr) {
+        LargeAllocs++;
+        LargeBytes += largeBytes;
+    }
+    else if (LargePages == LARGE_PAGES_REQUIRE) {
+        // Large pages have to be physically contiguous, so this fails once memory is fragmented.
+        printf("Large page allocation of %zu bytes failed!\n", largeBytes);
+        exit(1);
+    }
+
+    return ptr;
+}
+
+void* Memory::Alloc(size_t bytes, int node)
+{
+    void* ptr = AllocLarge(bytes, node);
+    if (ptr) return ptr;
+
+    if (node >= 0 && NumNodes > 1)
+        ptr = VirtualAllocExNuma(GetCurrentProcess(), NULL, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, node);
+    if (!ptr)
+        ptr = VirtualAlloc(NULL, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    if (ptr) {
+        SmallAllocs++;
+        SmallBytes += bytes;
+    }
+    return ptr;
+}
+
+void* Memory::AllocInterleaved(size_t bytes)
+{
+    if (NumNodes <= 1) return Alloc(bytes, -1);
+
+    // Fewer TLB misses are worth more than spreading the table across nodes.
+    void* ptr = AllocLarge(bytes, -1);
+    if (ptr) return ptr;
+
+    char* base = (char*)VirtualAlloc(NULL, bytes, MEM_RESERVE, PAGE_READWRITE);
+    if (!base) return NULL;
+
+    int chunk = 0;
+    for (size_t off = 0; off < bytes; off += InterleaveChunk, chunk++) {
+        size_t length = bytes - off < InterleaveChunk ? bytes - off : InterleaveChunk;
+        if (!VirtualAllocExNuma(GetCurrentProcess(), base + off, length, MEM_COMMIT, PAGE_READWRITE, nodeIds[chunk % NumNodes])
+            && !VirtualAlloc(base + off, length, MEM_COMMIT, PAGE_READWRITE)) {
+            VirtualFree(base, 0, MEM_RELEASE);
+            return NULL;
+        }
+    }
+
+    SmallAllocs++;
+    SmallBytes += bytes;
+    return base;
+}
+
+void Memory::Free(void* ptr)
+{
+    if (ptr) VirtualFree(ptr, 0, MEM_RELEASE);
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include <windows.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <atomic>
+
+#ifndef MEMORY_H
+#define MEMORY_H
+
+class Printer;
+
+enum LargePagePolicy
+{
+    LARGE_PAGES_OFF = 0,
+    LARGE_PAGES_TRY = 1,      // Use large pages where possible, fall back to 4 KB pages
+    LARGE_PAGES_REQUIRE = 2   // Exit if large pages cannot be used
+};
+
+// One logical processor, as placed by Memory::Init.
+typedef struct {
+    WORD group;
+    BYTE number;
+    int node;
+    int core;     // Index of the physical core across the machine
+    int sibling;  // 0 for the first logical processor of a core, 1+ for its SMT siblings
+} LogicalCpu;
+
+// NUMA topology, thread pinning and node-local allocation.
+//
+// Init reads the topology and lays the workers out over the logical processors: one
+// per physical core first, alternating between nodes, and only then SMT siblings.
+// Allocations made for a thread prefer that thread's node; shared tables are committed
+// in chunks spread round-robin over all nodes. On single-node hosts, or if Init was not
+// called, everything falls back to plain VirtualAlloc and pinning does nothing.
+//
+// With a large page policy, Alloc backs allocations with large pages (MEM_LARGE_PAGES,
+// 2 MB on x64), rounding sizes up to a whole page. This needs SeLockMemoryPrivilege
+// ("Lock pages in memory" in the local security policy). Large pages cannot be committed
+// piecemeal, so AllocInterleaved places a large-page table on a single node instead.
+//
+// Memory from Alloc/AllocInterleaved is zeroed and must be released with Free.
+class Memory
+{
+public:
+    static const size_t InterleaveChunk = 2 << 20;
+
+    static int NumNodes;
+    static int NumCores;
+    static int NumCpus;
+    static int NumThreads;
+    static LogicalCpu* ThreadCpus;  // Planned processor of each worker, NULL before Init
+
+    static int LargePages;
+    static size_t LargePageSize;
+    static std::atomic<long long> LargeAllocs;
+    static std::atomic<long long> LargeBytes;
+    static std::atomic<long long> SmallAllocs;
+    static std::atomic<long long> SmallBytes;
+
+    static void Init(int nThreads);
+    static void ReportPlacement(Printer& printer);
+
+    // Acquires SeLockMemoryPrivilege if the policy asks for large pages. Returns false
+    // only if the policy is LARGE_PAGES_REQUIRE and large pages are unavailable.
+    static bool SetLargePagePolicy(int policy, Printer& printer);
+    static void ReportLargePages(Printer& printer);
+
+    // Node of worker tid, or -1 when there is no topology to go by.
+    static int ThreadNode(int tid) { return ThreadCpus && NumNodes > 1 ? ThreadCpus[tid].node : -1; }
+
+    // Node the calling thread is running on, or -1 on single-node hosts.
+    static int CurrentNode();
+
+    // Pins the calling thread to worker tid's processor. Returns false if pinning failed.
+    static bool PinCurrentThread(int tid);
+
+    static void* Alloc(size_t bytes, int node);
+    static void* AllocInterleaved(size_t bytes);
+    static void Free(void* ptr);
+
+private:
+    static void* AllocLarge(size_t bytes, int node);
+};
+
+#endif
@@ -0,0 +1,133 @@
+#include <NoveltyFilter.hpp>
+#include <string.h>
+#include <math.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+static inline uint64_t fmix64(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xFF51AFD7ED558CCD;
+    k ^= k >> 33;
+    k *= 0xC4CEB9FE1A85EC53;
+    k ^= k >> 33;
+    return k;
+}
+
+NoveltyFilter::~NoveltyFilter()
+{
+    free(words);
+}
+
+void NoveltyFilter::Init(int logBits, int numHashes)
+{
+    if (logBits < 6) return;
+
+    nWords = (size_t)1 << (logBits - 6);
+    bitMask = ((uint64_t)1 << logBits) - 1;
+    NumHashes = numHashes;
+    words = (std::atomic<uint64_t>*)calloc(nWords, sizeof(std::atomic<uint64_t>));
+}
+
+bool NoveltyFilter::TestAndInsert(uint64_t hash, uint64_t* localCache, int localMask)
+{
+    // Zero marks an empty local slot, so never use it as a key.
+    if (hash == 0) hash = 1;
+
+    uint64_t& slot = localCache[hash & localMask];
+    if (slot == hash) return true;
+    slot = hash;
+
+    // Double hashing: bit i = h1 + i * h2.
+    uint64_t h1 = hash;
+    uint64_t h2 = fmix64(hash) | 1;
+    bool seen = true;
+    for (int i = 0; i < NumHashes; i++) {
+        uint64_t bit = (h1 + i * h2) & bitMask;
+        uint64_t mask = (uint64_t)1 << (bit & 63);
+        std::atomic<uint64_t>& word = words[bit >> 6];
+        if (!(word.load(std::memory_order_relaxed) & mask)) {
+            seen = false;
+            word.fetch_or(mask, std::memory_order_relaxed);
+        }
+    }
+
+    return seen;
+}
+
+double NoveltyFilter::EstimatedFalsePositiveRate()
+{
+    if (!words) return 0;
+
+    long long setBits = 0;
+    for (size_t i = 0; i < nWords; i++) {
+        uint64_t w = words[i].load(std::memory_order_relaxed);
+        while (w) {
+            w &= w - 1;
+            setBits++;
+        }
+    }
+
+    return pow((double)setBits / (double)(nWords * 64), NumHashes);
+}
+
+void NoveltyFilter::Clear()
+{
+    if (words) memset((void*)words, 0, nWords * sizeof(std::atomic<uint64_t>));
+}
+
+// Hashes a region word by word in four independent lanes. Words that look like pointers
+// into the DLL image are made relative to the image base first.
+uint64_t NoveltyFilter::HashRegion(uint64_t hash, const void* ptr, size_t length, uintptr_t imageBase, size_t imageSize)
+{
+    const uint64_t* words = (const uint64_t*)ptr;
+    size_t nWords = length / 8;
+    size_t i = 0;
+
+#if defined(__AVX2__) && (UINTPTR_MAX == UINT64_MAX)
+    // lo/hi bounds are biased by INT64_MIN so that the signed compare behaves as unsigned.
+    const __m256i bias = _mm256_set1_epi64x((long long)0x8000000000000000ULL);
+    const __m256i lo = _mm256_set1_epi64x((long long)(imageBase - 1) ^ (long long)0x8000000000000000ULL);
+    const __m256i hi = _mm256_set1_epi64x((long long)(imageBase + imageSize) ^ (long long)0x8000000000000000ULL);
+    const __m256i base = _mm256_set1_epi64x((long long)imageBase);
+    __m256i acc = _mm256_set1_epi64x((long long)hash);
+    for (; i + 4 <= nWords; i += 4) {
+        __m256i w = _mm256_loadu_si256((const __m256i*)(words + i));
+        __m256i wb = _mm256_xor_si256(w, bias);
+        __m256i inImage = _mm256_and_si256(_mm256_cmpgt_epi64(wb, lo), _mm256_cmpgt_epi64(hi, wb));
+        w = _mm256_sub_epi64(w, _mm256_and_si256(inImage, base));
+
+        // xorshift-add mixing; lanes are folded through fmix64 below.
+        acc = _mm256_xor_si256(acc, w);
+        acc = _mm256_add_epi64(acc, _mm256_slli_epi64(acc, 21));
+        acc = _mm256_xor_si256(acc, _mm256_srli_epi64(acc, 17));
+        acc = _mm256_add_epi64(acc, _mm256_slli_epi64(acc, 9));
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, acc);
+#else
+    uint64_t lanes[4] = { hash, hash ^ 0x9E3779B97F4A7C15, hash ^ 0xC2B2AE3D27D4EB4F, hash ^ 0x165667B19E3779F9 };
+    for (; i + 4 <= nWords; i += 4) {
+        for (int l = 0; l < 4; l++) {
+            uint64_t w = words[i + l];
+            if (w >= imageBase && w < imageBase + imageSize) w -= imageBase;
+            lanes[l] = (lanes[l] ^ w) * 0x9E3779B97F4A7C15;
+        }
+    }
+#endif
+
+    uint64_t h = hash;
+    for (int l = 0; l < 4; l++)
+        h = fmix64(h ^ lanes[l]);
+
+    for (; i < nWords; i++) {
+        uint64_t w = words[i];
+        if (w >= imageBase && w < imageBase + imageSize) w -= imageBase;
+        h = fmix64(h ^ w);
+    }
+
+    uint64_t tail = 0;
+    memcpy(&tail, words + nWords, length & 7);
+    return fmix64(h ^ tail ^ length);
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <atomic>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifndef NOVELTYFILTER_H
+#define NOVELTYFILTER_H
+
+// Approximate set of game states that some shot has already reached. States are
+// identified by a 64-bit hash over the regions of emulator memory the route cares
+// about (see Script::HashLiveState); pointers into the DLL image are hashed relative
+// to the image base so that every instance produces the same hash for the same state.
+//
+// Each thread first checks a small exact direct-mapped cache of its own recent
+// states, then a Bloom filter shared by all threads and updated with atomic ORs.
+// The filter only fills up, so MergeState clears it once its estimated false positive
+// rate passes NoveltyMaxFalsePositive; past that it would cut off most extensions.
+class NoveltyFilter
+{
+public:
+    int NumHashes = 4;
+
+    // Summed from the shot logs at merge.
+    long long FramesRun = 0;
+    long long FramesSaved = 0;
+    long long Checks = 0;
+    long long Hits = 0;
+    long long Clears = 0;
+
+    ~NoveltyFilter();
+
+    void Init(int logBits, int numHashes);
+    bool Enabled() { return words != NULL; }
+
+    // Returns true if the state was (probably) seen before; otherwise records it.
+    bool TestAndInsert(uint64_t hash, uint64_t* localCache, int localMask);
+
+    double EstimatedFalsePositiveRate();
+    void Clear();
+
+    static uint64_t HashRegion(uint64_t hash, const void* ptr, size_t length, uintptr_t imageBase, size_t imageSize);
+
+private:
+    std::atomic<uint64_t>* words = NULL;
+    size_t nWords = 0;
+    uint64_t bitMask = 0;
+};
+
+#endif
@@ -0,0 +1,210 @@
+#include <Scattershot.hpp>
+
+Partition::~Partition()
+{
+    free(nodes);
+    free(lastActive);
+    free(hashTab);
+    free(visits);
+}
+
+void Partition::Init(int capacity, int maxLevel)
+{
+    this->maxLevel = maxLevel < CellBits ? maxLevel : CellBits;
+    if (this->maxLevel <= 0 || capacity <= 0) {
+        this->maxLevel = 0;
+        return;
+    }
+
+    this->capacity = capacity;
+    hashSize = 2 * capacity + 1;
+    nodes = (Vec3d*)malloc(capacity * sizeof(Vec3d));
+    lastActive = (int*)malloc(capacity * sizeof(int));
+    hashTab = (int*)malloc(hashSize * sizeof(int));
+    for (int h = 0; h < hashSize; h++)
+        hashTab[h] = -1;
+}
+
+// Bins whose s wrapped around (upward speeds over 40) lose their top bits here.
+Vec3d Partition::Fine(Vec3d bin, int cellX, int cellY, int cellZ)
+{
+    bin.s = (bin.s & BinMask)
+        | (uint64_t)cellX << (CellShift + 2 * CellBits)
+        | (uint64_t)cellY << (CellShift + CellBits)
+        | (uint64_t)cellZ << CellShift;
+    return bin;
+}
+
+Vec3d Partition::Coarsen(Vec3d fine, int level)
+{
+    uint64_t keep = (uint64_t)((1 << level) - 1) << (CellBits - level);
+    uint64_t mask = BinMask | keep << (CellShift + 2 * CellBits) | keep << (CellShift + CellBits) | keep << CellShift;
+    fine.s = (fine.s & mask) | (uint64_t)level << LevelShift;
+    return fine;
+}
+
+Vec3d Partition::Map(Vec3d fine)
+{
+    int level = 0;
+    if (Splits > 0) {
+        while (level < maxLevel && Find(Coarsen(fine, level)) >= 0)
+            level++;
+    }
+    return Coarsen(fine, level);
+}
+
+int Partition::Find(Vec3d bin)
+{
+    for (uint64_t h = bin.hashPos() % hashSize; hashTab[h] >= 0; h = (h + 1) % hashSize) {
+        if (nodes[hashTab[h]].truncEq(bin))
+            return hashTab[h];
+    }
+    return -1;
+}
+
+void Partition::Rebuild()
+{
+    for (int h = 0; h < hashSize; h++)
+        hashTab[h] = -1;
+    for (int n = 0; n < Splits; n++) {
+        uint64_t h = nodes[n].hashPos() % hashSize;
+        while (hashTab[h] >= 0)
+            h = (h + 1) % hashSize;
+        hashTab[h] = n;
+    }
+}
+
+static int CompareVisits(const void* a, const void* b)
+{
+    const VisitRecord* va = (const VisitRecord*)a;
+    const VisitRecord* vb = (const VisitRecord*)b;
+    if (va->blockInx != vb->blockInx) return va->blockInx < vb->blockInx ? -1 : 1;
+    if (va->value != vb->value) return va->value < vb->value ? -1 : 1;
+    return 0;
+}
+
+// Called from MergeState after MergeStats, while the visit logs still index the shared
+// table they were taken against. Sorting the visits first makes the outcome independent
+// of which thread logged them.
+void Partition::Update(GlobalState& gState)
+{
+    Configuration& config = gState.config;
+    if (!Enabled()) return;
+
+    int nVisits = 0;
+    for (int tid = 0; tid < config.TotalThreads; tid++)
+        nVisits += gState.NVisits[tid];
+    if (nVisits > visitCapacity) {
+        visitCapacity = nVisits + nVisits / 2;
+        visits = (VisitRecord*)realloc(visits, visitCapacity * sizeof(VisitRecord));
+    }
+    nVisits = 0;
+    for (int tid = 0; tid < config.TotalThreads; tid++) {
+        memcpy(visits + nVisits, gState.VisitLogs[tid], gState.NVisits[tid] * sizeof(VisitRecord));
+        nVisits += gState.NVisits[tid];
+        gState.NVisits[tid] = 0;
+    }
+    qsort(visits, nVisits, sizeof(VisitRecord), CompareVisits);
+
+    int nSplits = Splits;
+    for (int start = 0; start < nVisits;) {
+        int blockInx = visits[start].blockInx;
+        double sum = 0, sumSq = 0;
+        int end = start;
+        for (; end < nVisits && visits[end].blockInx == blockInx; end++) {
+            sum += visits[end].value;
+            sumSq += (double)visits[end].value * visits[end].value;
+        }
+        int count = end - start;
+        start = end;
+
+        // A visit keeps every split cell above its block active. The block's cell is only
+        // a leaf of the current partition if all of those are still split.
+        Vec3d pos = gState.SharedBlocks[blockInx].pos;
+        int level = Level(pos);
+        bool leaf = true;
+        for (int l = 0; l < level; l++) {
+            int n = Find(Coarsen(pos, l));
+            if (n >= 0) lastActive[n] = gState.MergeCount;
+            else leaf = false;
+        }
+
+        double mean = sum / count;
+        double variance = sumSq / count - mean * mean;
+        if (!leaf || level >= maxLevel || count < config.SplitVisits || variance < (double)config.SplitSpread * config.SplitSpread)
+            continue;
+        if (Splits == capacity || Find(pos) >= 0)
+            continue;
+
+        nodes[Splits] = pos;
+        lastActive[Splits] = gState.MergeCount;
+        uint64_t h = pos.hashPos() % hashSize;
+        while (hashTab[h] >= 0)
+            h = (h + 1) % hashSize;
+        hashTab[h] = Splits++;
+    }
+    TotalSplits += Splits - nSplits;
+
+    // A cell's lastActive is never older than those of the split cells below it, so cold
+    // cells go together with everything split beneath them.
+    int keep = 0;
+    for (int n = 0; n < Splits; n++) {
+        if (gState.MergeCount - lastActive[n] >= config.MergeColdAfter)
+            continue;
+        nodes[keep] = nodes[n];
+        lastActive[keep] = lastActive[n];
+        keep++;
+    }
+    if (keep < Splits) {
+        TotalMerges += Splits - keep;
+        Splits = keep;
+        Rebuild();
+        foldDue = true;
+    }
+}
+
+// Moves the blocks of merged-back cells up to the leaf that now holds them and keeps the
+// best block of each leaf, as MergeBuffer would have. Called from MergeState after
+// MergeBlocks, so the blocks found in those cells during the epoch are folded as well.
+// The shared hash table is rebuilt over the moved bins as the duplicates are found.
+void Partition::Fold(GlobalState& gState)
+{
+    Configuration& config = gState.config;
+    if (!foldDue) return;
+    foldDue = false;
+
+    int nShared = gState.NBlocks[config.TotalThreads];
+    char* remove = (char*)calloc(nShared, 1);
+    memset(gState.SharedHashTab, 0xFF, config.MaxSharedHashes * sizeof(int));
+    for (int blockInd = 0; blockInd < nShared; blockInd++) {
+        Block& block = gState.SharedBlocks[blockInd];
+        int level = 0;
+        while (level < Level(block.pos) && Find(Coarsen(block.pos, level)) >= 0)
+            level++;
+        if (level < Level(block.pos)) {
+            block.pos = Coarsen(block.pos, level);
+            TotalFolded++;
+        }
+
+        int m = block.pos.findBlock(gState.SharedBlocks, gState.SharedHashTab, config.MaxSharedHashes, 0, blockInd);
+        if (m < 0 || m == blockInd) {
+            int hashInx = block.pos.findNewHashInx(gState.SharedHashTab, config.MaxSharedHashes);
+            if (hashInx >= 0) gState.SharedHashTab[hashInx] = blockInd;
+            continue;
+        }
+
+        // The loser goes; the winner takes the earlier index, which the hash table holds.
+        // Block 0 is the start of every search and stays.
+        if (m != 0 && (config.Deterministic ? Block::Beats(block.key(), gState.SharedBlocks[m].key()) : block.value > gState.SharedBlocks[m].value)) {
+            Block tmpBlock = gState.SharedBlocks[m];
+            gState.SharedBlocks[m] = block;
+            gState.SharedBlocks[blockInd] = tmpBlock;
+            BlockStats tmpStats = gState.SharedStats[m];
+            gState.SharedStats[m] = gState.SharedStats[blockInd];
+            gState.SharedStats[blockInd] = tmpStats;
+        }
+        remove[blockInd] = 1;
+    }
+    gState.RemoveBlocks(remove);
+    free(remove);
+}
@@ -0,0 +1,132 @@
+#include <ResultWriter.hpp>
+
+void ResultWriter::Start(const char* basePath, int offset, const char* archivePath)
+{
+    // The base header is the same for every result, so read it once.
+    headerLength = 0x400 + offset * 4;
+    header = (unsigned char*)calloc(headerLength, 1);
+    FILE* fp = fopen(basePath, "rb");
+    if (fp) {
+        fread(header, 1, headerLength, fp);
+        fclose(fp);
+    }
+    else {
+        printf("Could not read base m64 %s!\n", basePath);
+    }
+
+    if (archivePath) {
+        // The position of a stream opened for appending is unspecified until its first
+        // write (MSVC reports 0), so seek to the end before checking for a header.
+        archive = fopen(archivePath, "ab");
+        if (archive && fseek(archive, 0, SEEK_END) == 0 && ftell(archive) == 0) {
+            uint32_t len = headerLength;
+            fwrite("SSRA", 1, 4, archive);
+            fwrite(&len, sizeof(uint32_t), 1, archive);
+            fwrite(header, 1, headerLength, archive);
+        }
+    }
+
+    running = true;
+    writer = std::thread([this]() { Run(); });
+}
+
+void ResultWriter::Enqueue(const char* fileName, Input* inputs, int length)
+{
+    M64Result result;
+    strncpy(result.fileName, fileName, sizeof(result.fileName) - 1);
+    result.fileName[sizeof(result.fileName) - 1] = 0;
+    result.length = length;
+    result.inputs = (Input*)malloc(length * sizeof(Input));
+    memcpy(result.inputs, inputs, length * sizeof(Input));
+
+    while (!queue.TryPush(result))
+        std::this_thread::yield();
+    Enqueued++;
+}
+
+void ResultWriter::Stop()
+{
+    if (!running) return;
+
+    running = false;
+    writer.join();
+
+    if (archive) fclose(archive);
+    archive = NULL;
+    free(header);
+    header = NULL;
+}
+
+void ResultWriter::Run()
+{
+    M64Result batch[MaxBatch];
+
+    for (;;) {
+        int n = 0;
+        while (n < MaxBatch && queue.TryPop(batch[n])) n++;
+
+        if (n > 0) {
+            WriteBatch(batch, n);
+            continue;
+        }
+
+        // Drain whatever was queued before Stop() before exiting.
+        if (!running) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+}
+
+void ResultWriter::WriteBatch(M64Result* batch, int n)
+{
+    for (int i = 0; i < n; i++) {
+        M64Result& result = batch[i];
+
+        if (seen.size() >= MaxSeen) seen.clear();
+        if (!seen.insert(HashInputs(result.inputs, result.length)).second) {
+            Duplicates++;
+            free(result.inputs);
+            continue;
+        }
+
+        for (int f = 0; f < result.length; f++)
+            result.inputs[f].b = (result.inputs[f].b >> 8) | (result.inputs[f].b << 8); // Fuck me endianness
+
+        if (archive) {
+            uint32_t nameLength = (uint32_t)strlen(result.fileName);
+            uint32_t length = result.length;
+            fwrite(&nameLength, sizeof(uint32_t), 1, archive);
+            fwrite(result.fileName, 1, nameLength, archive);
+            fwrite(&length, sizeof(uint32_t), 1, archive);
+            fwrite(result.inputs, sizeof(Input), result.length, archive);
+            Written++;
+        }
+        else {
+            FILE* fp = fopen(result.fileName, "rb");
+            if (fp != NULL) {
+                fclose(fp);
+            }
+            else if ((fp = fopen(result.fileName, "wb")) != NULL) {
+                fwrite(header, 1, headerLength, fp);
+                fwrite(result.inputs, sizeof(Input), result.length, fp);
+                fclose(fp);
+                Written++;
+            }
+        }
+
+        free(result.inputs);
+    }
+
+    if (archive) fflush(archive);
+}
+
+uint64_t ResultWriter::HashInputs(Input* inputs, int length)
+{
+    // FNV-1a
+    uint64_t hash = 0xCBF29CE484222325;
+    const unsigned char* bytes = (const unsigned char*)inputs;
+    for (size_t i = 0; i < length * sizeof(Input); i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001B3;
+    }
+    return hash;
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include "Utils.hpp"
+#include "LockFreeQueue.hpp"
+#include <thread>
+#include <unordered_set>
+
+#ifndef RESULTWRITER_H
+#define RESULTWRITER_H
+
+typedef struct {
+    char fileName[128];
+    Input* inputs;
+    int length;
+} M64Result;
+
+// Writes m64 results found during emulation on a background thread. Workers only
+// copy the inputs and push them onto a lock-free queue; the writer keeps the base
+// m64 header in memory, drops results whose inputs it has already written, and
+// writes whatever has accumulated in one batch. It forgets the hashes once it holds
+// MaxSeen of them, so a result found again after that is written a second time.
+//
+// Results go either to individual m64 files (named by the caller, skipped if the
+// file already exists) or, if an archive path is given, appended to one file:
+//   "SSRA" | uint32 header length | base m64 header
+//   then per result: uint32 name length | name | uint32 input count | inputs (m64 byte order)
+class ResultWriter
+{
+public:
+    static const int QueueCapacity = 4096;
+    static const int MaxBatch = 256;
+    static const size_t MaxSeen = 1 << 20;  // Hashes kept for dropping duplicates, about 32MB
+
+    std::atomic<long long> Enqueued{ 0 };
+    std::atomic<long long> Written{ 0 };
+    std::atomic<long long> Duplicates{ 0 };
+
+    ResultWriter() : queue(QueueCapacity) { }
+    ~ResultWriter() { Stop(); }
+
+    void Start(const char* basePath, int offset, const char* archivePath);
+    void Enqueue(const char* fileName, Input* inputs, int length);
+    void Stop();
+
+private:
+    LockFreeQueue<M64Result> queue;
+    std::thread writer;
+    std::atomic<bool> running{ false };
+
+    unsigned char* header = NULL;
+    int headerLength = 0;
+    FILE* archive = NULL;
+    std::unordered_set<uint64_t> seen;
+
+    void Run();
+    void WriteBatch(M64Result* batch, int n);
+    static uint64_t HashInputs(Input* inputs, int length);
+};
+
+#endif
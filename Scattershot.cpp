@@ -7,7 +7,7 @@ int Vec3d::findNewHashInx(int* hashTab, int maxHashes) {
         if (hashTab[inx] == -1) return inx;
         Utils::xoro_r(&tmpSeed);
     }
-    printf("Failed to find new hash index after 100 tries!\n");
+    Printer::Warn(WARN_NEW_HASH_FAILED);
     return -1;
 }
 
@@ -46,7 +46,7 @@ int Vec3d::findBlock(Block* blocks, int* hashTab, int maxHashes, int nMin, int n
         }
         Utils::xoro_r(&tmpSeed);
     }
-    printf("Failed to find block from hash after 100 tries!\n");
+    Printer::Warn(WARN_FIND_BLOCK_FAILED);
     return -1; // TODO: Should be nMax?
 }
 
@@ -54,11 +54,23 @@ int Vec3d::findBlock(Block* blocks, int* hashTab, int maxHashes, int nMin, int n
 int Block::blockLength() {
     int len = 0;
     Segment* curSeg = tailSeg;
-    if (tailSeg->depth == 0) { printf("tailSeg depth is 0!\n"); }
+    if (tailSeg->depth == 0) { Printer::Warn(WARN_SEGMENT_DEPTH_ZERO); }
     while (curSeg != 0) {
-        if (curSeg->depth == 0) { printf("curSeg depth is 0!\n"); }
+        if (curSeg->depth == 0) { Printer::Warn(WARN_SEGMENT_DEPTH_ZERO); }
         len += curSeg->numFrames;
         curSeg = curSeg->parent;
     }
     return len;
 }
+
+BlockKey Block::key() {
+    BlockKey k = { value, tailSeg->depth, tailSeg->lastSeed(), tailSeg->numFrames };
+    return k;
+}
+
+bool Block::Beats(const BlockKey& a, const BlockKey& b) {
+    if (a.value != b.value) return a.value > b.value;
+    if (a.depth != b.depth) return a.depth < b.depth;
+    if (a.seed != b.seed) return a.seed < b.seed;
+    return a.numFrames < b.numFrames;
+}
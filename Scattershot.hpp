@@ -1,18 +1,41 @@
 #pragma once
 #include "Utils.hpp"
+#include "ResultWriter.hpp"
+#include "NoveltyFilter.hpp"
+#include "Snapshot.hpp"
+#include <functional>
 
 #ifndef SCATTERSHOT_H
 #define SCATTERSHOT_H
 
 typedef struct Segment Segment;
 
+// Frames from one seed, within a segment that GlobalState::CoalesceSegments built.
+typedef struct {
+    uint64_t seed;
+    uint16_t numFrames;
+} SegmentRun;
+
 struct Segment
 {
     Segment* parent;
-    uint64_t seed;
+    union {
+        uint64_t seed;       // Unless coalesced
+        SegmentRun* runs;    // If coalesced, up to a zero-length run
+    };
     uint32_t refCount;
-    uint8_t numFrames;
-    uint8_t depth;
+    uint16_t numFrames : 15; // Of all runs
+    uint16_t coalesced : 1;
+    uint16_t depth;
+
+    // The seed of the last run, which for a block's tail segment is the one its shot drew.
+    uint64_t lastSeed()
+    {
+        if (!coalesced) return seed;
+        SegmentRun* run = runs;
+        while (run[1].numFrames > 0) run++;
+        return run->seed;
+    }
 };
 
 class Block;
@@ -36,6 +59,17 @@ public:
 
 //fifd: I think this is an element of the partition of state
 //space. Will need to understand what each of its fields are
+// Total order on the candidates for one bin, used in deterministic mode so that which
+// candidate wins does not depend on which thread found it or when: higher value first,
+// then the shorter chain, then the seed and length of the tail segment, which identify
+// the shot and frame that produced it.
+typedef struct {
+    float value;
+    int depth;
+    uint64_t seed;
+    int numFrames;
+} BlockKey;
+
 class Block {
 public:
     Vec3d         pos;    //fifd: an output of truncFunc. Identifies which block this is
@@ -44,6 +78,77 @@ public:
     //Time is most important component of value but keeps higher hspeed if time is tied
 
     int blockLength();
+    BlockKey key();
+    static bool Beats(const BlockKey& a, const BlockKey& b);
+};
+
+// Exploration yield of a shared block, accumulated at merge from the shots fired at it.
+typedef struct {
+    uint32_t shots;
+    uint32_t discoveries;   // Blocks no table had before
+    uint32_t improvements;  // Better value for an existing block
+    uint32_t failures;      // Shots that faulted or did not reproduce the block, since the last epoch with one that did
+    uint32_t exits;         // Recent extensions from the block, halved past GlobalState::ExitWindow
+    uint32_t exitFrames;    // Frames those took to leave the block's bin
+} BlockStats;
+
+// One shot, as logged by the thread that fired it.
+typedef struct {
+    int baseInx;
+    uint8_t policy;
+    uint8_t strategy;
+    uint32_t discoveries;
+    uint32_t improvements;
+    uint32_t frames;        // All frames emulated for the shot
+    uint32_t replayFrames;  // Of those, frames spent replaying the base block's chain
+    uint32_t branches;      // Times the shot moved on to a block it found itself
+    uint8_t failed;         // The emulator faulted, or replaying the chain missed the block
+    uint32_t exits;         // Extensions that left the bin they started in
+    uint32_t exitFrames;
+    uint32_t noveltyChecks;
+    uint32_t noveltyHits;   // Extensions stopped on a state already explored
+    uint32_t framesSaved;   // Frames those would have run on for
+    float bestValue;        // Best value of the blocks the shot stored
+} ShotRecord;
+
+// A sampled arrival at an existing shared block, for Partition::Update.
+typedef struct {
+    int blockInx;
+    float value;
+} VisitRecord;
+
+// Where a shot's extensions start from: the emulator state and input after the last
+// frame leading to block, and how many frames of m64Diff lead up to it.
+typedef struct {
+    SaveState* state;
+    Block block;
+    Input input;
+    int frameOffset;
+} BranchPoint;
+
+enum TuneMode
+{
+    TUNE_OFF = 0,
+    TUNE_DRY_RUN = 1,  // Log recommended changes without applying them
+    TUNE_ON = 2
+};
+
+enum SelectionPolicy
+{
+    POLICY_HEURISTIC = 0,  // BlockSampler::NormWeight
+    POLICY_UCB = 1,        // BlockSampler::UcbWeight
+    POLICY_COUNT = 2,
+    POLICY_ALTERNATE = 3   // Switch between the two every merge, to compare them in one run
+};
+
+// How shots choose their base block and move on from it; see StrategyBases.
+enum SearchStrategy
+{
+    STRATEGY_SCATTERSHOT = 0,  // Sampler, lightning and root, branching per BranchFanout
+    STRATEGY_BEAM = 1,         // The best blocks of one depth layer, a layer deeper every merge
+    STRATEGY_REFINE = 2,       // Ancestors of the top blocks, climbing to better blocks from there
+    STRATEGY_COUNT = 3,
+    STRATEGY_ROTATE = 4        // Each of the above for StrategyMerges merges in turn, to compare them in one run
 };
 
 typedef struct {
@@ -53,6 +158,28 @@ typedef struct {
     float hspd;
 } FinePos;
 
+// Operation trace of the bookkeeping layer, recorded per thread so that
+// scattershot_bench -replay can run it again without an emulator.
+enum TraceOp : uint8_t
+{
+    TRACE_INIT = 1,         // Root block created. pos = root bin.
+    TRACE_MERGE = 2,        // Thread reached a merge barrier. seed = main iteration.
+    TRACE_SELECT_BASE = 3,  // Base block chosen. pos = base bin, seed = shared index.
+    TRACE_NEW_BLOCK = 4,    // ProcessNewBlock call, with its arguments.
+    TRACE_BRANCH = 5        // Shot continues from the block the previous ProcessNewBlock stored. pos = its bin.
+};
+
+#pragma pack(push, 1)
+typedef struct {
+    uint8_t op;
+    uint16_t numFrames;
+    uint8_t x, y, z;
+    uint64_t s;
+    uint64_t seed;
+    float value;
+} TraceRecord;
+#pragma pack(pop)
+
 class Configuration
 {
 public:
@@ -66,32 +193,464 @@ public:
     int TotalThreads;
     int MaxSharedSegments;
     int MaxLocalSegments;
-    int MaxLightningLength;
+    int MaxLightningLength;  // Shared blocks on the lightning paths
     long long MaxShots;
     int SegmentsPerShot;
     int ShotsPerMerge;
     int MergesPerSegmentGC;
+    int RecordTrace;
+    int ResultArchive;
+    int NoveltyFilterLogBits;
+    int NoveltyCheckInterval;
+    float NoveltyMaxFalsePositive;  // Clear the novelty filter at merge once its estimated rate passes this
+    int SelectionPolicy;
+    float UcbExploration;
+    int RetireAfterShots;
+    int TuneMode;
+    int MinSegmentsPerShot, MaxSegmentsPerShot;
+    int MinShotsPerMerge, MaxShotsPerMerge;
+    int MinSegmentLength, MaxSegmentLength;  // Segment::numFrames caps this at 32767
+    int MinMergesPerSegmentGC, MaxMergesPerSegmentGC;
+    int LargePages;
+    float EvictHighWatermark;  // Fractions of MaxSharedBlocks and MaxSharedSegments: evict once past high, down to low
+    float EvictLowWatermark;
+    int Deterministic;  // Reproducible runs; see ThreadState::BeginShot
+    int RestartAfterFaults;  // Consecutive faulted shots before a worker reinitializes its emulator
+    int BranchFanout;    // Extensions fired from a shot's origin before it may branch, 0 to disable
+    int TopK;            // Size of the top block index that exports, the lightning and refinement use; 0 to disable
+    int ExportInterval;  // Merges between exports of the top blocks, 0 to export only at the end
+    int MaxSplitLevel;   // Times a state bin's cell may be halved per axis, at most Partition::CellBits; 0 to disable
+    int MaxSplits;       // Split cells the partition may hold
+    int SplitVisits;     // Sampled visits to a block within one epoch before its cell may split
+    float SplitSpread;   // Least standard deviation of the visits' values for a split
+    int MergeColdAfter;  // Merges without sampled visits before a split cell is merged back
+    int VisitSampleMask; // Visits to shared blocks are sampled 1 in VisitSampleMask + 1
+    float SegmentExitMultiple;  // Shot length over the base block's frames to exit its bin, 0 for SegmentLength throughout
+    int CoalesceSegments;       // Fold segments that only lead to one other at GC
+    int LightningPaths;         // Top blocks whose chains make up the lightning, 0 to disable
+    int SnapshotInterval;       // Merges between snapshots for external inspection, 0 to disable
+    int Strategy;               // SearchStrategy
+    int StrategyMerges;         // Merges per strategy under STRATEGY_ROTATE
+    int BeamWidth;              // Blocks in the beam
+    int RefinePaths;            // Top blocks whose last segments refinement works on
+    int RefineSegments;         // Segments up their chains that refinement starts from
+    int BatchShots;             // Bases drawn at a time and replayed in chain order, 0 or 1 to replay each from the start
+    int ReplayStackStates;      // States a batch keeps along the chain it is replaying
+};
+
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    int32_t threadId;
+    Configuration config;
+} TraceHeader;
+
+class TraceRecorder
+{
+public:
+    // Bump whenever Configuration or TraceRecord changes layout or what its values mean,
+    // or old traces replay as garbage.
+    static const uint32_t Version = 9;
+    static const int BufferRecords = 1 << 16;
+
+    FILE* fp = NULL;
+    TraceRecord* buffer = NULL;
+    int nRecords = 0;
+
+    void Open(const char* path, Configuration& config, int threadId);
+    void Record(uint8_t op, Vec3d pos, uint64_t seed, int numFrames, float value);
+    void Flush();
+    void Close();
+};
+
+class GlobalState;
+
+// Samples shared block indices in proportion to a weight function, in constant time
+// per draw (Walker/Vose alias method). The table is rebuilt after every merge: all
+// threads compute weights in parallel, then one thread builds the alias table.
+class BlockSampler
+{
+public:
+    typedef std::function<float(GlobalState& gState, int blockInx)> WeightFunc;
+
+    WeightFunc Weight;
+    double TotalWeight = 0;
+    int NumBlocks = 0;
+    int NumWeighted = 0;
+    double RebuildTime = 0;
+
+    BlockSampler();
+    ~BlockSampler();
+
+    void Rebuild(GlobalState& gState);
+    int Sample(uint64_t* seed);
+
+    // Default weight: favours blocks away from a flat platform normal, as the original
+    // rejection sampler did, and excludes blocks that cannot be extended or whose shots failed.
+    static float NormWeight(GlobalState& gState, int blockInx);
+
+    // NormWeight scaled by an upper confidence bound on the block's yield (new or improved
+    // blocks per shot). Blocks shot RetireAfterShots times without any yield get weight 0.
+    static float UcbWeight(GlobalState& gState, int blockInx);
+
+private:
+    float* prob = NULL;
+    int* alias = NULL;
+    int* work = NULL;
+    int capacity = 0;
+};
+
+// What one merge epoch cost and produced, gathered by MergeStats, MergeBlocks and MergeState.
+typedef struct {
+    double epochTime;  // From the end of the previous merge to the start of this one
+    double mergeTime;  // Merge plus the previous sampler rebuild
+    double gcTime;
+    long long shots;
+    long long frames;
+    long long replayFrames;
+    long long strategyFrames[STRATEGY_COUNT];  // Frames of the shots each strategy chose
+    long long newBlocks;      // Shared blocks MergeBlocks inserted or improved
+    long long spilledBlocks;  // Blocks that were handed off in full local buffers
+    float sharedSegmentFill;  // As a fraction of MaxSharedSegments
+} EpochStats;
+
+// Full local buffers a thread handed off since the last merge, so that it could keep
+// recording discoveries instead of dropping them. MergeSegments takes the segments
+// before the thread's current list; MergeBlocks takes the buffers after its current
+// buffer, newest first.
+typedef struct {
+    Block** buffers;
+    int* bufferBlocks;
+    int nBuffers;
+    int bufferCapacity;
+    struct Segment** segments;
+    int nSegments;
+    int segmentCapacity;
+    long long spilledBlocks;    // Totals over the run, summed into GlobalState at merge
+    long long spilledSegments;
+} SpillQueue;
+
+// The TopK shared blocks by value, best first, kept up to date as MergeBuffer inserts and
+// improves blocks. Entries refer to shared indices, so eviction has to rebuild the list.
+class TopBlocks
+{
+public:
+    int* Inx = NULL;
+    float* Value = NULL;
+    int Count = 0;
+    int Capacity = 0;
+
+    ~TopBlocks();
+
+    void Init(int capacity);
+    void Offer(int blockInx, float value);
+    void Rebuild(Block* blocks, int nBlocks);
+};
+
+// Adaptive refinement of the spatial cells of Script::GetStateBin. GetFineStateBin also
+// encodes where in its cell each coordinate lies, CellBits bits per axis, above the bits
+// the bin itself uses. A cell split l times keeps the top l of those bits and records l
+// in the top bits of s; Map follows the splits down to the leaf that holds a fine bin.
+// Level 0 is the fixed grid, so with no splits Map returns the original bins.
+//
+// Update runs at merge: it splits the cells of blocks whose sampled visits are frequent
+// and spread over a wide range of values, and merges back split cells that stopped
+// seeing visits. Workers only read the partition between merges, so it needs no locks.
+// A block whose cell is split is no longer drawn as a base, as any shot from it would
+// leave its bin on the first frame; its sub-cells take over. When a cell merges back,
+// Fold moves the blocks below it up into it.
+class Partition
+{
+public:
+    static const int CellBits = 4;
+    static const int CellShift = 48;   // Sub-cells of x, y and z in bits 56-59, 52-55 and 48-51
+    static const int LevelShift = 60;
+    static const uint64_t BinMask = (1ULL << CellShift) - 1;
+
+    int Splits = 0;
+    long long TotalSplits = 0;
+    long long TotalMerges = 0;
+    long long TotalFolded = 0;  // Blocks moved up into a merged-back cell
+
+    ~Partition();
+
+    void Init(int capacity, int maxLevel);
+    bool Enabled() { return maxLevel > 0; }
+
+    static Vec3d Fine(Vec3d bin, int cellX, int cellY, int cellZ);
+    static Vec3d Coarsen(Vec3d fine, int level);
+    static int Level(Vec3d bin) { return (int)(bin.s >> LevelShift); }
+    Vec3d Map(Vec3d fine);
+    bool IsSplit(Vec3d bin) { return Splits > 0 && Find(bin) >= 0; }
+    void Update(GlobalState& gState);
+    void Fold(GlobalState& gState);
+
+private:
+    Vec3d* nodes = NULL;     // Split cells
+    int* lastActive = NULL;  // Merge at which each last had a sampled visit below it
+    int* hashTab = NULL;
+    VisitRecord* visits = NULL;
+    int capacity = 0;
+    int hashSize = 0;
+    int visitCapacity = 0;
+    int maxLevel = 0;
+    bool foldDue = false;    // Cells merged back since the last Fold
+
+    int Find(Vec3d bin);
+    void Rebuild();
+};
+
+// Writes the shared table to the named section described in Snapshot.hpp, for monitors
+// such as scattershot_inspect to read while the search runs.
+class SnapshotPublisher
+{
+public:
+    long long Published = 0;
+
+    ~SnapshotPublisher();
+
+    bool Open(int capacity, Printer& printer, int target);
+    bool Enabled() { return header != NULL; }
+    void Publish(GlobalState& gState);
+
+private:
+    HANDLE mapping = NULL;
+    SnapshotHeader* header = NULL;
+    SnapshotBlock* blocks = NULL;
+    size_t size = 0;
+    size_t committed = 0;
+    int nPublished = 0;
+    double startTime = 0;
+};
+
+// What sets a search strategy apart, in StrategyBases::Strategies by SearchStrategy. Any
+// of the functions may be NULL. build picks the strategy's bases at merge, select draws
+// one of them or returns -1, and status prints its line of the status report. The flags
+// say how its shots move on from the block they extend.
+typedef struct {
+    const char* name;
+    void (*build)(GlobalState& gState);
+    int (*select)(GlobalState& gState, uint64_t* seed);
+    void (*status)(GlobalState& gState);
+    bool climbs;   // To the first block stored that beats the one extended
+    bool fansOut;  // To the next block stored once BranchFanout extensions left the origin
+} StrategyOps;
+
+// Base blocks for the strategies other than scattershot, rebuilt at the end of every
+// merge for the one the next epoch runs. The beam holds the BeamWidth best blocks of its
+// depth layer and moves one layer deeper each merge; refinement draws from the blocks
+// RefineSegments segments up the chains of the RefinePaths best. Select returns -1 when
+// the active strategy has no bases, and the shot falls back to scattershot's choice.
+class StrategyBases
+{
+public:
+    static const StrategyOps Strategies[STRATEGY_COUNT];
+
+    TopBlocks Beam;
+    int BeamDepth = 0;
+    int NumAnchors = 0;
+
+    ~StrategyBases();
+
+    void Init(int beamWidth, int refinePaths);
+    void Rebuild(GlobalState& gState);
+    int Select(GlobalState& gState, uint64_t* seed);
+    void PrintStatus(GlobalState& gState);
+
+private:
+    int* anchors = NULL;
+    int lastStrategy = STRATEGY_SCATTERSHOT;
+
+    static void BuildBeam(GlobalState& gState);
+    static int SelectBeam(GlobalState& gState, uint64_t* seed);
+    static void BeamStatus(GlobalState& gState);
+    static void BuildAnchors(GlobalState& gState);
+    static int SelectAnchor(GlobalState& gState, uint64_t* seed);
+    static void RefineStatus(GlobalState& gState);
+};
+
+class ThreadState;
+
+// A shot drawn into a ShotBatch, with what SelectBaseBlock left in ThreadState for it.
+typedef struct {
+    Block base;
+    int baseInx;
+    int shotRecord;     // Its ShotRecord in the thread's log
+    int segmentLength;
+    int strategy;
+    uint64_t rngSeed;   // For the shot's extensions
+    Segment** chain;    // Root first
+    int nChain;
+    int shared;         // Leading segments in common with the previous shot's chain
+} BatchShot;
+
+// The emulator state after the first depth segments of the chain being replayed.
+typedef struct {
+    SaveState state;
+    int depth;
+    Input input;
+    int frameOffset;
+} ReplayPoint;
+
+// Draws BatchShots base blocks at once, exactly as the shots would have drawn them one at
+// a time, and fires them in order of their chains from the root, so that shots sharing
+// an ancestry come one after another. Replaying a shot's chain then starts from the
+// deepest state saved on it rather than from the start, and saves the states where later
+// shots of the batch leave it, as a stack that follows the depth-first order of the
+// segment tree. A batch never reaches past the next merge, so its chains stay valid.
+class ShotBatch
+{
+public:
+    BatchShot* Shots = NULL;
+    int Count = 0;
+    int Fired = 0;
+
+    ~ShotBatch();
+
+    void Init(Configuration& config, Dll& dll);
+    bool Enabled() { return capacity > 1; }
+    bool Draw(ThreadState& tState, int shotsSinceMerge, long long mainIteration);
+    BatchShot& Next() { return Shots[Fired++]; }
+    BatchShot& Current() { return Shots[Fired - 1]; }
+    ReplayPoint* Resume();
+    ReplayPoint* SavePoint(int depth);
+    void Invalidate() { nPoints = 0; }
+
+private:
+    int capacity = 0;
+    Segment** chains = NULL;
+    int chainCapacity = 0;
+    ReplayPoint* points = NULL;
+    int nPoints = 0;
+    int maxPoints = 0;
+    int* saveDepths = NULL;  // Where later shots leave the current chain, deepest first
+    int nSaves = 0;
+};
+
+// Retunes SegmentsPerShot, ShotsPerMerge, MergesPerSegmentGC and SegmentLength at every
+// merge, within the Min/Max bounds in Configuration. The first three follow the cost
+// ratios they trade off; SegmentLength has no such ratio, so it hill-climbs on new
+// blocks per second, unless shots choose their own length (SegmentExitMultiple). Runs inside the merge's SingleThread, so changing config is safe.
+class Tuner
+{
+public:
+    static constexpr float MaxMergeOverhead = 0.05f;
+    static constexpr float MinMergeOverhead = 0.01f;
+    static constexpr float MaxReplayFraction = 0.3f;
+    static constexpr float MinReplayFraction = 0.1f;
+    static constexpr float MaxGCOverhead = 0.05f;
+    static constexpr float MaxSharedSegmentFill = 0.75f;
+    static constexpr float ClimbDeadBand = 0.05f;  // Blocks/s changes smaller than this are noise
+
+    EpochStats Epoch = {};
+    double BlocksPerSecond = 0;
+    long long Adjustments = 0;
+
+    void Update(GlobalState& gState, double mergeStart, double gcTime);
+    // Restarts the epoch clock when the threads come back from other targets' epochs.
+    void Resume() { if (lastMergeEnd > 0) lastMergeEnd = omp_get_wtime(); }
+
+private:
+    double lastMergeEnd = 0;
+    double lastClimbRate = 0;
+    int climbDirection = 1;
+
+    void Adjust(GlobalState& gState, const char* name, int& value, int target, int lo, int hi, const char* reason, double measure);
 };
 
 class GlobalState
 {
 public:
+    static const uint32_t ExitWindow = 64;
+    static const uint32_t MaxFailures = 3;  // Failed shots in a row before a block is no longer shot at
+
     struct Segment** AllSegments;
-    Block* AllBlocks;
-    int* AllHashTabs;
+    Block** LocalBlocks;
+    int** LocalHashTabs;
     int* NBlocks;
     int* NSegments;
     Block* SharedBlocks;
     int* SharedHashTab;
+    BlockStats* SharedStats;
+    ShotRecord** ShotLogs;
+    int* NShots;
+    int* ShotLogCapacity;
+    VisitRecord** VisitLogs;
+    int* NVisits;
+    int* VisitLogCapacity;
+    SpillQueue* Spills;
+
+    int MergeCount = 0;
+    int ActivePolicy = POLICY_HEURISTIC;
+    long long TotalShots = 0;
+    long long RetiredBlocks = 0;
+    long long PolicyShots[POLICY_COUNT] = { 0 };
+    long long PolicyYield[POLICY_COUNT] = { 0 };
+    long long PolicyFrames[POLICY_COUNT] = { 0 };
+    int ActiveStrategy = STRATEGY_SCATTERSHOT;
+    long long StrategyShots[STRATEGY_COUNT] = { 0 };
+    long long StrategyDiscoveries[STRATEGY_COUNT] = { 0 };
+    double StrategyTime[STRATEGY_COUNT] = { 0 };  // Thread-seconds, each epoch's split by the frames of its shots
+    double StrategyGain[STRATEGY_COUNT] = { 0 };  // Rises of the best value to blocks its shots stored
+    long long Branches = 0;
+    std::atomic<long long> Faults{ 0 };
+    std::atomic<long long> Desyncs{ 0 };
+    std::atomic<long long> Restarts{ 0 };
+    std::atomic<long long> BatchedShots{ 0 };
+    std::atomic<long long> BatchReplayFrames{ 0 };   // Chain frames batched shots emulated
+    std::atomic<long long> BatchSkippedFrames{ 0 };  // and those they resumed past
+    int MergesSinceGC = 0;
+    long long CoalescedSegments = 0;
+    long long EvictedBlocks = 0;
+    long long DroppedBlocks = 0;
+    long long DroppedSegments = 0;
+    long long SpilledBlocks = 0;  // Summed from the spill queues in MergeStats
+    long long SpilledSegments = 0;
+    int LastEvicted = 0;
     Configuration& config;
     Printer& printer;
+    ResultWriter Results;
+    NoveltyFilter Novelty;
+    BlockSampler Sampler;
+    TopBlocks Top;
+    Partition Bins;
+    SnapshotPublisher Snapshot;
+    StrategyBases Search;
+    Input** ExportInputs;  // Reconstructed inputs per rank of Top, NULL if the chain failed to reproduce
+    int* ExportLengths;
+    long long ExportedBlocks = 0;
+    long long ExportMismatches = 0;
+    Tuner Tuning;
+    int* Lightning;  // Shared indices of the blocks along the best chains, rebuilt every merge
+    int LightningLength = 0;
+    int LightningPaths = 0;
+    char OutputName[256];  // Prefix of the files the run writes for this table
 
-    GlobalState(Configuration& config, Printer& printer);
+    GlobalState(Configuration& config, Printer& printer, int target = 0, const char* targetName = NULL);
+    ~GlobalState();
 
-    void MergeState(int mainIteration);
+    void MergeState();
+    bool SegmentGCDue() { return MergesSinceGC + 1 >= config.MergesPerSegmentGC; }
+    void MergeStats();
     void MergeBlocks();
+    void MergeBuffer(Block* blocks, int nBlocks);
     void MergeSegments();
+    int EvictBlocks();
+    void RemoveBlocks(char* remove);
+    uint64_t Digest();
+    bool Failing(int blockInx) { return SharedStats[blockInx].failures >= MaxFailures; }
+    // Whether a shot may still start from the block: it is below the segment bound, has not
+    // failed too often and its bin has not been split away from it.
+    bool Extendable(int blockInx)
+    {
+        Block& block = SharedBlocks[blockInx];
+        return block.tailSeg->depth < config.MaxSegments && !Failing(blockInx) && !Bins.IsSplit(block.pos);
+    }
+    bool ExportDue() { return config.TopK > 0 && config.ExportInterval > 0 && MergeCount % config.ExportInterval == 0; }
+    bool SnapshotDue() { return Snapshot.Enabled() && MergeCount % config.SnapshotInterval == 0; }
     void SegmentGarbageCollection();
+    int CoalesceSegments();
+    void BuildLightning();
 };
 
 class ThreadState
@@ -107,25 +666,42 @@ public:
     Block BaseBlock;
     Vec3d BaseStateBin;
     Input CurrentInput;
-
+    long long ShotIndex = 0;  // Global shot number, deterministic mode only
+    int ShotSegmentLength;    // Frames per extension in the current shot
+    int ShotStrategy;         // Strategy that chose the current shot's base
+    int CurrentShot = 0;      // Index of its ShotRecord
+    Segment** Chain;          // Scratch for DecodeAndExecuteDiff, tail first
+    int ChainCapacity;
 
     double LoadTime = 0;
     double BlockTime = 0;
     double RunTime = 0;
     double LoopTimeStamp = 0;
 
-    // TODO: Unimplemented?
-    int LightningLength;
-    int LightningLengthLocal;
-    Vec3d* Lightning;
-    Vec3d* LightningLocal;
+    TraceRecorder Trace;
+
+    static const int NoveltyCacheMask = (1 << 16) - 1;
+    uint64_t* NoveltyCache = NULL;
 
     ThreadState(Configuration& config, GlobalState& gState, int id);
+    ~ThreadState();
     void Initialize(Vec3d initTruncPos);
-    bool SelectBaseBlock(int mainIteration);
-    void UpdateLightning(Vec3d stateBin);
+    bool MergeDue(int shotsSinceMerge);
+    void BeginShot(int shotsSinceMerge);
+    bool SelectBaseBlock(long long mainIteration);
+    void ResumeShot(BatchShot& shot);
+    void SpillBlocks();
+    void SpillSegments();
+    void LogShot(int baseInx);
+    void AddFrames(int nFrames, bool replay = false);
+    void LogBranch();
+    void LogFailure();
+    void LogVisit(int blockInx, float value);
+    void LogExit(int frames);
+    void LogNoveltyCheck(bool hit, int framesSaved);
+    int ChooseSegmentLength(int baseInx);
     bool ValidateBaseBlock(Vec3d baseBlockStateBin);
-    void ProcessNewBlock(uint64_t prevRngSeed, int nFrames, Vec3d newPos, float newFitness);
+    bool ProcessNewBlock(uint64_t prevRngSeed, int nFrames, Vec3d newPos, float newFitness, Block* stored = NULL);
     void PrintStatus(int mainIteration);
 };
 
@@ -1,5 +1,6 @@
 #pragma once
 #include "Utils.hpp"
+#include "StickSolver.hpp"
 
 #ifndef SCRIPT_H
 #define SCRIPT_H
@@ -58,6 +59,16 @@
 
 //look at threads 1, 6, 7, 8, 9, 10, 12
 
+class Script;
+
+// A search target's own way to bin and score states, for variants of the route's
+// objective. fineStateBin returns bins as GetFineStateBin does, through Partition::Fine.
+// A NULL entry keeps the route's own GetFineStateBin or StateBinFitness.
+typedef struct {
+    Vec3d (*fineStateBin)(Script& script);
+    float (*fitness)(Script& script);
+} Objective;
+
 class Script
 {
 public:
@@ -65,12 +76,13 @@ public:
     GlobalState& gState;
     ThreadState& tState;
     Dll& dll;
+    Objective objective;
 
     int StartCourse;
     int StartArea;
 
-    Script(Configuration& config, GlobalState& gState, ThreadState& tState, Dll& dll)
-        : config(config), gState(gState), tState(tState), dll(dll) { }
+    Script(Configuration& config, GlobalState& gState, ThreadState& tState, Dll& dll, Objective objective)
+        : config(config), gState(gState), tState(tState), dll(dll), objective(objective) { }
 
     void Initialize(Vec3d initTruncPos)
     {
@@ -87,55 +99,162 @@ public:
             && StartArea == *(short*)GetProcAddress(dll.hdll, "gCurrAreaIndex");
     }
 
-    int DecodeAndExecuteDiff(Input* m64Diff)
+    // Collects the chain into tState.Chain in one walk up, then replays it from the root.
+    // A broken chain is replayed as far as it goes; the caller's bin check then fails.
+    int DecodeAndExecuteDiff(Input* m64Diff, Segment* thisTailSeg)
+    {
+        int frameOffset = 0;
+        if (thisTailSeg == 0) {
+            Printer::Warn(WARN_SEGMENT_CHAIN_BROKEN);
+            return frameOffset;
+        }
+
+        int nChain = 0;
+        for (Segment* curSeg = thisTailSeg; curSeg != 0 && nChain < tState.ChainCapacity; curSeg = curSeg->parent) {
+            if (curSeg->parent ? curSeg->parent->depth + 1 != curSeg->depth : curSeg->depth != 1)
+                Printer::Warn(WARN_SEGMENT_CHAIN_BROKEN);
+            tState.Chain[nChain++] = curSeg;
+        }
+
+        for (int i = nChain - 1; i >= 0; i--)
+            frameOffset = ExecuteSegment(m64Diff, frameOffset, tState.Chain[i]);
+
+        return frameOffset;
+    }
+
+    // Replays the batch's next shot's chain from the deepest state the batch saved on it, or
+    // from startState, saving states on the way where later shots of the batch leave it.
+    // The inputs before a saved state are still in m64Diff from the shot that saved it: the
+    // shots in between only write past their own base, which is deeper.
+    int ReplayBatchShot(ShotBatch& batch, SaveState& startState, Input* m64Diff, int* replayed)
+    {
+        BatchShot& shot = batch.Current();
+        ReplayPoint* point = batch.Resume();
+        int depth = 0;
+        int frameOffset = 0;
+        if (point) {
+            tState.LoadTime += point->state.riskyLoadJ(dll);
+            tState.CurrentInput = point->input;
+            depth = point->depth;
+            frameOffset = point->frameOffset;
+        }
+        else {
+            tState.LoadTime += startState.riskyLoadJ(dll);
+        }
+        int skipped = frameOffset;
+
+        if (shot.nChain == 0)
+            Printer::Warn(WARN_SEGMENT_CHAIN_BROKEN);
+        while (depth < shot.nChain) {
+            frameOffset = ExecuteSegment(m64Diff, frameOffset, shot.chain[depth++]);
+            if (ReplayPoint* save = batch.SavePoint(depth)) {
+                save->state.save(dll);
+                save->input = tState.CurrentInput;
+                save->frameOffset = frameOffset;
+            }
+        }
+
+        *replayed = frameOffset - skipped;
+        gState.BatchedShots++;
+        gState.BatchReplayFrames += *replayed;
+        gState.BatchSkippedFrames += skipped;
+        return frameOffset;
+    }
+
+    int ExecuteSegment(Input* m64Diff, int frameOffset, Segment* seg)
+    {
+        if (!seg->coalesced)
+            return ExecuteRun(m64Diff, frameOffset, seg->seed, seg->numFrames);
+        for (SegmentRun* run = seg->runs; run->numFrames > 0; run++)
+            frameOffset = ExecuteRun(m64Diff, frameOffset, run->seed, run->numFrames);
+        return frameOffset;
+    }
+
+    // Replays the inputs one extension generated from seed.
+    int ExecuteRun(Input* m64Diff, int frameOffset, uint64_t seed, int numFrames)
     {
         Input* gControllerPads = (Input*)GetProcAddress(dll.hdll, "gControllerPads");
         VOIDFUNC sm64_update = (VOIDFUNC)GetProcAddress(dll.hdll, "sm64_update");
 
-        int frameOffset = 0;
+        uint64_t tmpSeed = seed;
+        int megaRandom = Utils::xoro_r(&tmpSeed) % 2;
+        for (int f = 0; f < numFrames; f++) {
+            perturbInput(&tState.CurrentInput, &tmpSeed, frameOffset, megaRandom);
+            m64Diff[frameOffset++] = tState.CurrentInput;
+            *gControllerPads = tState.CurrentInput;
+            sm64_update();
+        }
+
+        return frameOffset;
+    }
 
-        //UPDATED FOR SEGMENTS STRUCT
-        //Before, I temporarily reversed the linked list.
-        //But this doesn't work in a multi threaded environment.
-        //Punt and do this in quadratic time. This shouldn't be a
-        //bottleneck anyway but can fix it if needed
-        if (tState.BaseBlock.tailSeg == 0)
-            printf("origBlock has null tailSeg");
-
-        Segment* thisTailSeg = tState.BaseBlock.tailSeg;
-        Segment* curSeg;
-        int thisSegDepth = thisTailSeg->depth;
-        for (int i = 1; i <= thisSegDepth; i++) {
-            curSeg = thisTailSeg;
-            while (curSeg->depth != i) {  //inefficient but probably doesn't matter
-                if (curSeg->parent == 0)
-                    printf("Parent is null!");
-                if (curSeg->parent->depth + 1 != curSeg->depth) { printf("Depths wrong"); }
-                curSeg = curSeg->parent;
+    // Writes the top blocks as m64s. Must be called by every thread of the parallel region:
+    // each re-emulates its share of the chains from startState on its own instance and
+    // checks that they still end in the block's bin, then one thread queues the whole
+    // list, best first, so the writer gets it as a batch. A chain that faults the emulator
+    // counts as a mismatch. The fault can leave memory outside riskyLoadJ's ranges dirty,
+    // so all of advancedState, the memory the chains were recorded on, is loaded again.
+    void ExportTopBlocks(SaveState& advancedState, SaveState& startState, Input* m64Diff)
+    {
+        TopBlocks& top = gState.Top;
+
+        #pragma omp for schedule(dynamic, 1)
+        for (int rank = 0; rank < top.Count; rank++) {
+            Block& block = gState.SharedBlocks[top.Inx[rank]];
+            int length = 0;
+            bool matched = false;
+            auto replay = [&]()
+                {
+                    tState.LoadTime += startState.riskyLoadJ(dll);
+                    length = DecodeAndExecuteDiff(m64Diff, block.tailSeg);
+                    matched = Partition::Coarsen(GetFineStateBin(), Partition::Level(block.pos)).truncEq(block.pos);
+                };
+
+            gState.ExportInputs[rank] = NULL;
+            unsigned long faultCode = 0;
+            if (!Utils::TryRun(replay, dll.hdll, dll.imageSize, &faultCode)) {
+                gState.Faults++;
+                advancedState.load(dll);
+                tState.LoadTime += startState.riskyLoadJ(dll);
+                continue;
             }
+            if (!matched)
+                continue;
+            gState.ExportInputs[rank] = (Input*)malloc(length * sizeof(Input));
+            memcpy(gState.ExportInputs[rank], m64Diff, length * sizeof(Input));
+            gState.ExportLengths[rank] = length;
+        }
 
-            //Run the inputs
-            uint64_t tmpSeed = curSeg->seed;
-            int megaRandom = Utils::xoro_r(&tmpSeed) % 2;
-            for (int f = 0; f < curSeg->numFrames; f++) {
-                perturbInput(&tState.CurrentInput, &tmpSeed, frameOffset, megaRandom);
-                m64Diff[frameOffset++] = tState.CurrentInput;
-                *gControllerPads = tState.CurrentInput;
-                sm64_update();
+        #pragma omp single
+        {
+            for (int rank = 0; rank < top.Count; rank++) {
+                if (!gState.ExportInputs[rank]) {
+                    gState.ExportMismatches++;
+                    continue;
+                }
 
-                tState.UpdateLightning(GetStateBin());
+                char fileName[256];
+                sprintf(fileName, "%s_top_%d_%d_%f.m64", gState.OutputName, gState.MergeCount, rank, top.Value[rank]);
+                gState.Results.Enqueue(fileName, gState.ExportInputs[rank], gState.ExportLengths[rank]);
+                free(gState.ExportInputs[rank]);
+                gState.ExportInputs[rank] = NULL;
+                gState.ExportedBlocks++;
             }
+            gState.printer.printfQ("EXPORT top %d blocks, best %f, mismatches %lld\n",
+                top.Count, top.Count ? top.Value[0] : 0.0f, gState.ExportMismatches);
         }
-
-        return frameOffset;
     }
 
-    void ExtendTasFromBlock(Input* m64Diff, int frameOffset, int megaRandom, uint64_t baseRngSeed, Vec3d prevStateBin)
+    // With a branch point, stops at the first block that goes into the local table with a
+    // value above branchValue, saves the state there into *branch and returns true, so that
+    // the rest of the shot can extend from it instead of replaying its way back from the base.
+    bool ExtendTasFromBlock(Input* m64Diff, int frameOffset, int megaRandom, uint64_t baseRngSeed, Vec3d prevStateBin, BranchPoint* branch = NULL, float branchValue = -FLT_MAX)
     {
         VOIDFUNC sm64_update = (VOIDFUNC)GetProcAddress(dll.hdll, "sm64_update");
         Input* gControllerPads = (Input*)GetProcAddress(dll.hdll, "gControllerPads");
 
-        for (int f = 0; f < config.SegmentLength; f++) {
+        bool exited = false;
+        for (int f = 0; f < tState.ShotSegmentLength; f++) {
             perturbInput(&tState.CurrentInput, &tState.RngSeed, frameOffset + f, megaRandom);
             m64Diff[frameOffset + f] = tState.CurrentInput;
             *gControllerPads = tState.CurrentInput;
@@ -144,23 +263,75 @@ public:
             sm64_update();
             tState.RunTime += omp_get_wtime() - timerStart;
 
-            if (!ValidateCourseAndArea() || !ValidateBlock(m64Diff, frameOffset + f))
-                break;
+            if (!ValidateCourseAndArea() || !ValidateBlock(m64Diff, frameOffset + f)) {
+                tState.AddFrames(f + 1);
+                return false;
+            }
 
             Vec3d newStateBin = GetStateBin();
-            tState.UpdateLightning(newStateBin);
 
             //fifd: Checks to see if we're in a new Block. If so, save off the segment so far.
             timerStart = omp_get_wtime();
             if (!newStateBin.truncEq(prevStateBin) && !newStateBin.truncEq(tState.BaseBlock.pos))
             {
+                if (!exited) {
+                    tState.LogExit(f + 1);
+                    exited = true;
+                }
+
                 // Create and add block to list.
-                tState.ProcessNewBlock(baseRngSeed, f, newStateBin, StateBinFitness());
+                Block stored;
+                bool isStored = tState.ProcessNewBlock(baseRngSeed, f, newStateBin, StateBinFitness(), &stored);
 
                 prevStateBin = newStateBin; // TODO: Why this here?
+
+                if (isStored && branch && stored.tailSeg->depth < config.MaxSegments && stored.value > branchValue) {
+                    branch->state->save(dll);
+                    branch->block = stored;
+                    branch->input = tState.CurrentInput;
+                    branch->frameOffset = frameOffset + f + 1;
+                    tState.Trace.Record(TRACE_BRANCH, newStateBin, 0, 0, stored.value);
+                    tState.BlockTime += omp_get_wtime() - timerStart;
+
+                    tState.AddFrames(f + 1);
+                    return true;
+                }
             }
             tState.BlockTime += omp_get_wtime() - timerStart;
+
+            // Stop once the shot converges onto a state some earlier shot already explored.
+            if (gState.Novelty.Enabled() && (f + 1) % config.NoveltyCheckInterval == 0) {
+                bool seen = gState.Novelty.TestAndInsert(HashLiveState(), tState.NoveltyCache, ThreadState::NoveltyCacheMask);
+                tState.LogNoveltyCheck(seen, tState.ShotSegmentLength - f - 1);
+                if (seen) {
+                    tState.AddFrames(f + 1);
+                    return false;
+                }
+            }
         }
+
+        // An extension that never left counts as leaving on its last frame.
+        if (!exited)
+            tState.LogExit(tState.ShotSegmentLength);
+        tState.AddFrames(tState.ShotSegmentLength);
+        return false;
+    }
+
+    // Hash of the mutable state that drives this route: Mario, the pyramid and bully
+    // objects, the camera, and the last input (which carries the pause-buffer phase).
+    uint64_t HashLiveState()
+    {
+        uintptr_t base = (uintptr_t)dll.hdll;
+        char* gMarioStates = (char*)GetProcAddress(dll.hdll, "gMarioStates");
+        char* gObjectPool = (char*)GetProcAddress(dll.hdll, "gObjectPool");
+        char* gCamera = (char*)GetProcAddress(dll.hdll, "gCamera");
+
+        uint64_t hash = *(uint32_t*)&tState.CurrentInput;
+        hash = NoveltyFilter::HashRegion(hash, gMarioStates, 256, base, dll.imageSize);
+        hash = NoveltyFilter::HashRegion(hash, gObjectPool + 84 * 1392, 1392, base, dll.imageSize);
+        hash = NoveltyFilter::HashRegion(hash, gObjectPool + 57 * 1392, 1392, base, dll.imageSize);
+        hash = NoveltyFilter::HashRegion(hash, gCamera, 512, base, dll.imageSize);
+        return hash;
     }
 
     //fifd: Where new inputs to try are actually produced
@@ -244,6 +415,9 @@ public:
         }
 
 
+        // Yaw of the pyramid's downhill direction, as the game would compute it.
+        int downhillAngle = StickSolver::Atan2s(*pyraZNorm, *pyraXNorm);
+
         if (frame == 0 || Utils::xoro_r(seed) % jFact == 0) {
             int choice = Utils::xoro_r(seed) % 3;
             if (choice == 0) {  //fifd: with probability 1/3, random joystick
@@ -251,10 +425,6 @@ public:
                 in->y = (Utils::xoro_r(seed) % 256) - 128;
             }
             else if (choice == 1) { //fifd: with probability 1/3, go as close as we can to barely downhill
-                int downhillAngle = 0;
-                if (pyraZNorm != 0) {
-                    downhillAngle = ((int)(atan(*pyraXNorm / *pyraZNorm) * 32768.0 / M_PI)) % 65536;
-                }
                 int lefthillAngle = downhillAngle - 16384;
                 int righthillAngle = downhillAngle + 16384;
                 int lefthillDiff = *marioYawFacing - lefthillAngle;
@@ -265,35 +435,15 @@ public:
                 else {
                     tarAng = (int)righthillAngle - (int)*camYaw + (Utils::xoro_r(seed) % 80 - 10);
                 }
-                float tarRad = tarAng * M_PI / 32768.0;
-                float tarX = 100 * sin(tarRad);
-                float tarY = -100 * cos(tarRad);
-                if (tarX > 0) { tarX += 6; }
-                else { tarX -= 6; };
-                if (tarY > 0) { tarY += 6; }
-                else { tarY -= 6; };
-                in->x = round(tarX);
-                in->y = round(tarY);
+                StickSolver::Aim(in, (uint16_t)tarAng);
             }
             else if (choice == 2) { //match yaw
                 int tarAng = (int)*marioYawFacing - (int)*camYaw;
-                float tarRad = tarAng * M_PI / 32768.0;
-                float tarX = 100 * sin(tarRad);
-                float tarY = -100 * cos(tarRad);
-                if (tarX > 0) { tarX += 6; }
-                else { tarX -= 6; };
-                if (tarY > 0) { tarY += 6; }
-                else { tarY -= 6; };
-                in->x = round(tarX);
-                in->y = round(tarY);
+                StickSolver::Aim(in, (uint16_t)tarAng);
             }
         }
 
 
-        int downhillAngle = 0;
-        if (pyraZNorm != 0) {
-            downhillAngle = ((int)(atan(*pyraXNorm / *pyraZNorm) * 32768.0 / M_PI)) % 65536;
-        }
         int uphillDiff = (*marioYawFacing - downhillAngle + 32768 + 65536 * 2) % 65536;
         //check for pbdr conditions
         if (fabs(*pyraXNorm) + fabs(*pyraZNorm) > .6 && *marioHSpd >= 29.0 &&
@@ -302,15 +452,7 @@ public:
             //printf("did this\n");
             //printf("%f %f %f %d \n", pyraXNorm, pyraZNorm, marioHSpd, uphillDiff);
             int tarAng = (int)*marioYawFacing - (int)*camYaw + Utils::xoro_r(seed) % 14000 - 7000;
-            float tarRad = tarAng * M_PI / 32768.0;
-            float tarX = 100 * sin(tarRad);
-            float tarY = -100 * cos(tarRad);
-            if (tarX > 0) { tarX += 6; }
-            else { tarX -= 6; };
-            if (tarY > 0) { tarY += 6; }
-            else { tarY -= 6; };
-            in->x = round(tarX);
-            in->y = round(tarY);
+            StickSolver::Aim(in, (uint16_t)tarAng);
             in->b = 0;
             in->b |= CONT_B;  //dive
             in->b |= CONT_START;  //pause for pause buffer
@@ -341,8 +483,24 @@ public:
     //output has 3 spatial coordinates (which cube in space Mario is in) and a variable called
     //s, which contains information about the action, button presses, camera mode,
     //hspd, and yaw
+    //The partition decides how finely each cell is cut; see Partition.
     Vec3d GetStateBin()
     {
+        return gState.Bins.Map(GetFineStateBin());
+    }
+
+    //Where a coordinate lies within its grid cell, in Partition::CellBits bits.
+    static int SubCell(float coord, float origin, float width)
+    {
+        float cell = (coord + origin) / width;
+        return (int)((cell - floor(cell)) * (1 << Partition::CellBits)) & ((1 << Partition::CellBits) - 1);
+    }
+
+    //GetStateBin as if every cell were split down to the finest sub-cells.
+    Vec3d GetFineStateBin()
+    {
+        if (objective.fineStateBin) return objective.fineStateBin(*this);
+
         void* gMarioStates = GetProcAddress(dll.hdll, "gMarioStates");
         void* gObjectPool = GetProcAddress(dll.hdll, "gObjectPool");
         void* gCamera = GetProcAddress(dll.hdll, "gCamera");
@@ -410,7 +568,8 @@ public:
             s *= 2;
             s += 1; //mark bad norm regime
 
-            return Vec3d{ (uint8_t)floor((*x + 2330) / 200), (uint8_t)floor((*y + 3200) / 400), (uint8_t)floor((*z + 1090) / 200), s };
+            return Partition::Fine(Vec3d{ (uint8_t)floor((*x + 2330) / 200), (uint8_t)floor((*y + 3200) / 400), (uint8_t)floor((*z + 1090) / 200), s },
+                SubCell(*x, 2330, 200), SubCell(*y, 3200, 400), SubCell(*z, 1090, 200));
         }
         s *= 200;
         s += (int)((*pyraXNorm + 1) * 100);
@@ -433,11 +592,14 @@ public:
 
         s *= 2; //mark good norm regime
 
-        return Vec3d{ (uint8_t)floor((*x + 2330) / 10), (uint8_t)floor((*y + 3200) / 50), (uint8_t)floor((*z + 1090) / 10), s };
+        return Partition::Fine(Vec3d{ (uint8_t)floor((*x + 2330) / 10), (uint8_t)floor((*y + 3200) / 50), (uint8_t)floor((*z + 1090) / 10), s },
+            SubCell(*x, 2330, 10), SubCell(*y, 3200, 50), SubCell(*z, 1090, 10));
     }
 
     float StateBinFitness()
     {
+        if (objective.fitness) return objective.fitness(*this);
+
         void* gObjectPool = GetProcAddress(dll.hdll, "gObjectPool");
         float* pyraYNorm = (float*)((char*)gObjectPool + 84 * 1392 + 328);
 
@@ -488,7 +650,7 @@ public:
             char fileName[128];
             //printf("dr\n");
             sprintf(fileName, "C:\\Users\\Tyler\\Documents\\repos\\scattershot\\x64\\Debug\\m64s\\dr\\bitfs_dr_%f_%f_%f_%f_%d.m64", *pyraXNorm, *pyraYNorm, *pyraZNorm, *marioYVel, tState.Id);
-            Utils::writeFile(fileName, "C:\\Users\\Tyler\\Documents\\repos\\scattershot\\x64\\Debug\\4_units_from_edge.m64", m64Diff, config.StartFrame, frame + 1);
+            gState.Results.Enqueue(fileName, m64Diff, frame + 1);
         }
 
         //check on hspd > 1 confirms we're in dr land rather than quickstopping,
@@ -498,7 +660,7 @@ public:
             char fileName[128];
             //if(printingDRLand > 0)printf("dr land\n");
             sprintf(fileName, "C:\\Users\\Tyler\\Documents\\repos\\scattershot\\x64\\Debug\\m64s\\drland\\bitfs_drland_%f_%f_%f_%d.m64", *pyraXNorm, *pyraYNorm, *pyraZNorm, tState.Id);
-            Utils::writeFile(fileName, "C:\\Users\\Tyler\\Documents\\repos\\scattershot\\x64\\Debug\\4_units_from_edge.m64", m64Diff, config.StartFrame, frame + 1);
+            gState.Results.Enqueue(fileName, m64Diff, frame + 1);
         }
 
         return true;
@@ -0,0 +1,133 @@
+#include <Scattershot.hpp>
+
+ShotBatch::~ShotBatch()
+{
+    for (int n = 0; n < maxPoints; n++)
+        points[n].state.freeState();
+    free(points);
+    free(Shots);
+    free(chains);
+    free(saveDepths);
+}
+
+void ShotBatch::Init(Configuration& config, Dll& dll)
+{
+    if (config.BatchShots <= 1) return;
+
+    capacity = config.BatchShots;
+    chainCapacity = config.MaxSegments + 2;
+    Shots = (BatchShot*)malloc(capacity * sizeof(BatchShot));
+    chains = (Segment**)malloc((size_t)capacity * chainCapacity * sizeof(Segment*));
+    saveDepths = (int*)malloc(capacity * sizeof(int));
+    maxPoints = config.ReplayStackStates;
+    points = (ReplayPoint*)malloc(maxPoints * sizeof(ReplayPoint));
+    for (int n = 0; n < maxPoints; n++)
+        points[n].state.allocState(dll);
+}
+
+// Lexicographic on the chains from the root, so that chains sharing a prefix are adjacent.
+static int CompareChains(const void* a, const void* b)
+{
+    const BatchShot* x = (const BatchShot*)a;
+    const BatchShot* y = (const BatchShot*)b;
+    for (int n = 0; n < x->nChain && n < y->nChain; n++) {
+        if (x->chain[n] != y->chain[n])
+            return (uintptr_t)x->chain[n] < (uintptr_t)y->chain[n] ? -1 : 1;
+    }
+    return x->nChain - y->nChain;
+}
+
+// Returns false if a draw found no base block. The shots drawn before it are then
+// dropped along with their ShotRecords, as none of them was fired. Each shot's random
+// draws and ShotRecord are its own, so the order the batch is fired in changes neither
+// what a shot does nor, in deterministic mode, the merged table.
+bool ShotBatch::Draw(ThreadState& tState, int shotsSinceMerge, long long mainIteration)
+{
+    Configuration& config = tState.config;
+    Count = Fired = 0;
+    nPoints = 0;
+
+    int firstRecord = tState.gState.NShots[tState.Id];
+    for (; Count < capacity && !tState.MergeDue(shotsSinceMerge + Count); Count++) {
+        tState.BeginShot(shotsSinceMerge + Count);
+        if (!tState.SelectBaseBlock(config.Deterministic ? tState.ShotIndex : mainIteration + Count)) {
+            tState.gState.NShots[tState.Id] = firstRecord;
+            Count = 0;
+            return false;
+        }
+
+        BatchShot& shot = Shots[Count];
+        shot.base = tState.BaseBlock;
+        shot.baseInx = tState.gState.ShotLogs[tState.Id][tState.CurrentShot].baseInx;
+        shot.shotRecord = tState.CurrentShot;
+        shot.segmentLength = tState.ShotSegmentLength;
+        shot.strategy = tState.ShotStrategy;
+        // Outside deterministic mode the thread's stream runs on into the next draw, so
+        // the shot's extensions get a seed of their own from it.
+        if (config.Deterministic)
+            shot.rngSeed = tState.RngSeed;
+        else {
+            uint64_t high = Utils::xoro_r(&tState.RngSeed);
+            shot.rngSeed = high << 32 | Utils::xoro_r(&tState.RngSeed);
+        }
+        shot.chain = chains + (size_t)Count * chainCapacity;
+
+        // Collected tail first, then stored root first.
+        int nChain = 0;
+        for (Segment* curSeg = shot.base.tailSeg; curSeg != 0 && nChain < chainCapacity; curSeg = curSeg->parent) {
+            if (curSeg->parent ? curSeg->parent->depth + 1 != curSeg->depth : curSeg->depth != 1)
+                Printer::Warn(WARN_SEGMENT_CHAIN_BROKEN);
+            tState.Chain[nChain++] = curSeg;
+        }
+        for (int n = 0; n < nChain; n++)
+            shot.chain[n] = tState.Chain[nChain - 1 - n];
+        shot.nChain = nChain;
+    }
+
+    qsort(Shots, Count, sizeof(BatchShot), CompareChains);
+    for (int n = 0; n < Count; n++) {
+        BatchShot& shot = Shots[n];
+        shot.shared = 0;
+        if (n == 0) continue;
+        BatchShot& prev = Shots[n - 1];
+        while (shot.shared < shot.nChain && shot.shared < prev.nChain && shot.chain[shot.shared] == prev.chain[shot.shared])
+            shot.shared++;
+    }
+    return true;
+}
+
+// Drops the saved states that lie off the current shot's chain and returns the deepest
+// one left, or NULL to replay from the start. The later shots that share part of the
+// chain leave it where their shared prefix, minimized over the shots in between, drops.
+ReplayPoint* ShotBatch::Resume()
+{
+    BatchShot& shot = Current();
+    while (nPoints > 0 && points[nPoints - 1].depth > shot.shared)
+        nPoints--;
+    int from = nPoints > 0 ? points[nPoints - 1].depth : 0;
+
+    nSaves = 0;
+    int prefix = shot.nChain + 1;
+    for (int n = Fired; n < Count && prefix > from; n++) {
+        if (Shots[n].shared >= prefix) continue;
+        prefix = Shots[n].shared;
+        if (prefix > from) saveDepths[nSaves++] = prefix;
+    }
+
+    return nPoints > 0 ? &points[nPoints - 1] : NULL;
+}
+
+// Returns the point to save the state at, if a later shot leaves the chain depth segments
+// in and the stack has room. The caller fills it in.
+ReplayPoint* ShotBatch::SavePoint(int depth)
+{
+    if (nSaves == 0 || saveDepths[nSaves - 1] != depth)
+        return NULL;
+    nSaves--;
+    if (nPoints == maxPoints)
+        return NULL;
+
+    ReplayPoint* point = &points[nPoints++];
+    point->depth = depth;
+    return point;
+}
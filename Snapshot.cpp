@@ -0,0 +1,102 @@
+#include <Scattershot.hpp>
+
+SnapshotPublisher::~SnapshotPublisher()
+{
+    if (header) UnmapViewOfFile(header);
+    if (mapping) CloseHandle(mapping);
+}
+
+// The section is sized for capacity records but reserved rather than committed; Publish
+// commits pages as the table grows, so a small run does not tie up MaxSharedBlocks worth.
+bool SnapshotPublisher::Open(int capacity, Printer& printer, int target)
+{
+    char name[64];
+    if (target == 0)
+        sprintf(name, SNAPSHOT_NAME_FORMAT, GetCurrentProcessId());
+    else
+        sprintf(name, SNAPSHOT_TARGET_NAME_FORMAT, GetCurrentProcessId(), target);
+    size = sizeof(SnapshotHeader) + (size_t)capacity * sizeof(SnapshotBlock);
+
+    mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE | SEC_RESERVE,
+        (DWORD)((uint64_t)size >> 32), (DWORD)size, name);
+    if (!mapping) {
+        printer.printfQ("SNAPSHOT could not create %s (error %lu)\n", name, GetLastError());
+        return false;
+    }
+
+    void* view = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, size);
+    if (!view || !VirtualAlloc(view, sizeof(SnapshotHeader), MEM_COMMIT, PAGE_READWRITE)) {
+        printer.printfQ("SNAPSHOT could not map %s (error %lu)\n", name, GetLastError());
+        if (view) UnmapViewOfFile(view);
+        CloseHandle(mapping);
+        mapping = NULL;
+        return false;
+    }
+
+    header = (SnapshotHeader*)view;
+    blocks = (SnapshotBlock*)(header + 1);
+    committed = sizeof(SnapshotHeader);
+    memcpy(header->magic, "SSSN", 4);
+    header->version = SnapshotVersion;
+    header->sequence.store(0);
+    header->capacity = capacity;
+    startTime = omp_get_wtime();
+
+    printer.printfQ("SNAPSHOT publishing to %s\n", name);
+    return true;
+}
+
+// Must be called by every thread of the enclosing parallel region (or outside of one),
+// between merges, while the shared table holds still.
+void SnapshotPublisher::Publish(GlobalState& gState)
+{
+    if (!header) return;
+
+    #pragma omp single
+    {
+        nPublished = gState.NBlocks[gState.config.TotalThreads];
+        if (nPublished > header->capacity) nPublished = header->capacity;
+
+        size_t needed = sizeof(SnapshotHeader) + (size_t)nPublished * sizeof(SnapshotBlock);
+        if (needed > committed) {
+            size_t target = needed + needed / 2 < size ? needed + needed / 2 : size;
+            if (VirtualAlloc(header, target, MEM_COMMIT, PAGE_READWRITE))
+                committed = target;
+            else
+                nPublished = (int)((committed - sizeof(SnapshotHeader)) / sizeof(SnapshotBlock));
+        }
+
+        // Odd while the records are being written.
+        header->sequence.store(header->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    #pragma omp for schedule(static)
+    for (int blockInd = 0; blockInd < nPublished; blockInd++) {
+        Block& block = gState.SharedBlocks[blockInd];
+        BlockStats& stats = gState.SharedStats[blockInd];
+        SnapshotBlock& rec = blocks[blockInd];
+        rec.x = block.pos.x;
+        rec.y = block.pos.y;
+        rec.z = block.pos.z;
+        rec.failed = gState.Failing(blockInd);
+        rec.depth = block.tailSeg->depth;
+        rec.level = (uint16_t)Partition::Level(block.pos);
+        rec.s = block.pos.s;
+        rec.value = block.value;
+        rec.shots = stats.shots;
+        rec.discoveries = stats.discoveries;
+        rec.improvements = stats.improvements;
+    }
+
+    #pragma omp single
+    {
+        header->nBlocks = nPublished;
+        header->merge = gState.MergeCount;
+        header->nSegments = gState.NSegments[gState.config.TotalThreads];
+        header->totalShots = gState.TotalShots;
+        header->runTime = omp_get_wtime() - startTime;
+        header->sequence.fetch_add(1, std::memory_order_release);
+        Published++;
+    }
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+// Layout of the snapshot of the shared block table that a run publishes in a named shared
+// memory section every SnapshotInterval merges, for scattershot_inspect and other monitors.
+// The section holds a SnapshotHeader followed by nBlocks SnapshotBlock records.
+//
+// Readers map it read-only and follow the seqlock: load sequence, copy what they need,
+// load it again, and retry if it was odd (a publish in progress) or has changed. Nothing
+// here is ever read by the search itself, so monitoring costs it nothing but the copy.
+#define SNAPSHOT_NAME_FORMAT "Local\\scattershot_snapshot_%lu"  // Process id of the run
+#define SNAPSHOT_TARGET_NAME_FORMAT "Local\\scattershot_snapshot_%lu_%d"  // and the target, after the first
+
+static const uint32_t SnapshotVersion = 1;
+
+typedef struct {
+    char magic[4];  // "SSSN"
+    uint32_t version;
+    std::atomic<uint64_t> sequence;
+    int32_t capacity;  // Records the section has room for
+    int32_t nBlocks;
+    int32_t merge;
+    int32_t nSegments;
+    int64_t totalShots;
+    double runTime;  // Seconds since the run started
+} SnapshotHeader;
+
+typedef struct {
+    uint8_t x, y, z;
+    uint8_t failed;
+    uint16_t depth;
+    uint16_t level;  // Partition level of the bin
+    uint64_t s;
+    float value;
+    uint32_t shots;
+    uint32_t discoveries;
+    uint32_t improvements;
+} SnapshotBlock;
+
+#endif
@@ -0,0 +1,86 @@
+#include <StickSolver.hpp>
+#include <math.h>
+
+int StickSolver::ExactYaws = 0;
+uint16_t StickSolver::arctanTable[StickSolver::ArctanTableSize];
+int8_t StickSolver::stickX[65536];
+int8_t StickSolver::stickY[65536];
+
+void StickSolver::Init(Dll& dll)
+{
+    const int16_t* gArctanTable = (const int16_t*)GetProcAddress(dll.hdll, "gArctanTable");
+    for (int i = 0; i < ArctanTableSize; i++)
+        arctanTable[i] = gArctanTable ? (uint16_t)gArctanTable[i] : (uint16_t)lround(atan(i / 1024.0) * 32768.0 / M_PI);
+
+    // Every raw stick position that reaches full tilt, as adjust_analog_stick processes it.
+    static bool found[65536];
+    memset(found, 0, sizeof(found));
+    for (int rawX = -128; rawX < 128; rawX++) {
+        for (int rawY = -128; rawY < 128; rawY++) {
+            float x = rawX <= -8 ? rawX + 6 : rawX >= 8 ? rawX - 6 : 0;
+            float y = rawY <= -8 ? rawY + 6 : rawY >= 8 ? rawY - 6 : 0;
+            float mag = sqrtf(x * x + y * y);
+            if (mag < 64) continue;
+            x *= 64 / mag;
+            y *= 64 / mag;
+
+            uint16_t yaw = Atan2s(-y, x);
+            if (found[yaw]) continue;
+            found[yaw] = true;
+            stickX[yaw] = (int8_t)rawX;
+            stickY[yaw] = (int8_t)rawY;
+        }
+    }
+
+    // Fill the yaws no stick produces from the nearest one that some stick does.
+    ExactYaws = 0;
+    for (int yaw = 0; yaw < 65536; yaw++) {
+        if (found[yaw]) {
+            ExactYaws++;
+            continue;
+        }
+
+        int before = (yaw - 1) & 0xFFFF, after = (yaw + 1) & 0xFFFF;
+        int distBefore = 1, distAfter = 1;
+        while (!found[before]) { before = (before - 1) & 0xFFFF; distBefore++; }
+        while (!found[after]) { after = (after + 1) & 0xFFFF; distAfter++; }
+        int nearest = distBefore <= distAfter ? before : after;
+        stickX[yaw] = stickX[nearest];
+        stickY[yaw] = stickY[nearest];
+    }
+}
+
+uint16_t StickSolver::AtanLookup(float y, float x)
+{
+    if (x == 0) return arctanTable[0];
+    return arctanTable[(int32_t)(y / x * 1024 + 0.5f)];
+}
+
+uint16_t StickSolver::Atan2s(float y, float x)
+{
+    uint16_t ret;
+    if (x >= 0) {
+        if (y >= 0) {
+            if (y >= x) ret = AtanLookup(x, y);
+            else ret = 0x4000 - AtanLookup(y, x);
+        }
+        else {
+            y = -y;
+            if (y < x) ret = 0x4000 + AtanLookup(y, x);
+            else ret = 0x8000 - AtanLookup(x, y);
+        }
+    }
+    else {
+        x = -x;
+        if (y < 0) {
+            y = -y;
+            if (y >= x) ret = 0x8000 + AtanLookup(x, y);
+            else ret = 0xC000 - AtanLookup(y, x);
+        }
+        else {
+            if (y < x) ret = 0xC000 + AtanLookup(y, x);
+            else ret = -AtanLookup(x, y);
+        }
+    }
+    return ret;
+}
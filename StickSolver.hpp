@@ -0,0 +1,44 @@
+#pragma once
+#include "Utils.hpp"
+
+#ifndef STICKSOLVER_H
+#define STICKSOLVER_H
+
+// Angle arithmetic the way SM64 does it, for aiming the analog stick.
+//
+// The game turns the raw stick into a direction by removing an 8 unit deadzone (shifting
+// the rest in by 6), clamping the magnitude to 64, and taking atan2s of the result. Its
+// atan2s reads a 1025 entry arctangent table, so only about 8192 of the 65536 angle units
+// can come out of it at all. Init runs every raw stick position through that same
+// processing once and records, for every camera-relative yaw, the full-tilt stick that
+// gives exactly that yaw, or the nearest yaw the game can produce.
+class StickSolver
+{
+public:
+    static const int ArctanTableSize = 1025;
+
+    static int ExactYaws;  // Yaws some full-tilt stick hits exactly
+
+    // Uses the DLL's gArctanTable if it exports it, otherwise a computed copy.
+    static void Init(Dll& dll);
+
+    // SM64's atan2s: the angle whose cosine goes with y and sine with x, so that
+    // Atan2s(dz, dx) is the yaw of the direction (dx, dz).
+    static uint16_t Atan2s(float y, float x);
+
+    // Sets the stick of in to full tilt towards yaw, relative to the camera.
+    static void Aim(Input* in, uint16_t yaw)
+    {
+        in->x = stickX[yaw];
+        in->y = stickY[yaw];
+    }
+
+private:
+    static uint16_t arctanTable[ArctanTableSize];
+    static int8_t stickX[65536];
+    static int8_t stickY[65536];
+
+    static uint16_t AtanLookup(float y, float x);
+};
+
+#endif
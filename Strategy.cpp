@@ -0,0 +1,123 @@
+#include <Scattershot.hpp>
+
+StrategyBases::~StrategyBases()
+{
+    free(anchors);
+}
+
+void StrategyBases::Init(int beamWidth, int refinePaths)
+{
+    Beam.Init(beamWidth);
+    anchors = (int*)malloc((refinePaths + 1) * sizeof(int));
+}
+
+const StrategyOps StrategyBases::Strategies[STRATEGY_COUNT] = {
+    { "scattershot", NULL, NULL, NULL, false, true },
+    { "beam", BuildBeam, SelectBeam, BeamStatus, false, false },
+    { "refine", BuildAnchors, SelectAnchor, RefineStatus, true, false },
+};
+
+// Runs last in MergeState, once MergeStats has picked ActiveStrategy for the next epoch.
+void StrategyBases::Rebuild(GlobalState& gState)
+{
+    Beam.Count = 0;
+    NumAnchors = 0;
+
+    const StrategyOps& strategy = Strategies[gState.ActiveStrategy];
+    if (strategy.build) strategy.build(gState);
+    lastStrategy = gState.ActiveStrategy;
+}
+
+int StrategyBases::Select(GlobalState& gState, uint64_t* seed)
+{
+    const StrategyOps& strategy = Strategies[gState.ActiveStrategy];
+    return strategy.select ? strategy.select(gState, seed) : -1;
+}
+
+void StrategyBases::PrintStatus(GlobalState& gState)
+{
+    const StrategyOps& strategy = Strategies[gState.ActiveStrategy];
+    if (strategy.status) strategy.status(gState);
+}
+
+// Takes the next layer once it holds an extendable block, which after an epoch of shots
+// at the beam it normally does. Coalescing at GC can lower the depths under the beam, and
+// improvements can move a layer's blocks deeper, so failing that it falls back to the
+// nearest layer that has one, above if there is any. On entering the beam it starts just
+// above the best block, so that its layer is the first the beam takes.
+void StrategyBases::BuildBeam(GlobalState& gState)
+{
+    StrategyBases& search = gState.Search;
+    if (search.lastStrategy != STRATEGY_BEAM)
+        search.BeamDepth = gState.Top.Count > 0 ? gState.SharedBlocks[gState.Top.Inx[0]].tailSeg->depth - 1 : 0;
+
+    int nShared = gState.NBlocks[gState.config.TotalThreads];
+    int target = search.BeamDepth + 1;
+    for (int pass = 0; pass < 2 && target > 0; pass++) {
+        int above = 0, below = 0;
+        for (int blockInd = 0; blockInd < nShared; blockInd++) {
+            if (!gState.Extendable(blockInd)) continue;
+            int depth = gState.SharedBlocks[blockInd].tailSeg->depth;
+            if (depth == target) search.Beam.Offer(blockInd, gState.SharedBlocks[blockInd].value);
+            else if (depth < target && depth > above) above = depth;
+            else if (depth > target && (below == 0 || depth < below)) below = depth;
+        }
+        if (search.Beam.Count > 0) {
+            search.BeamDepth = target;
+            return;
+        }
+        target = above > 0 ? above : below;
+    }
+}
+
+int StrategyBases::SelectBeam(GlobalState& gState, uint64_t* seed)
+{
+    StrategyBases& search = gState.Search;
+    return search.Beam.Count > 0 ? search.Beam.Inx[Utils::xoro_r(seed) % search.Beam.Count] : -1;
+}
+
+void StrategyBases::BeamStatus(GlobalState& gState)
+{
+    gState.printer.printfQ("BEAM depth %d, %d blocks\n", gState.Search.BeamDepth, gState.Search.Beam.Count);
+}
+
+// A top block's anchor is the block that ends RefineSegments segments up its chain, or the
+// nearest one above if none ends there. Uses refCount as BuildLightning does, which is
+// done with it by now.
+void StrategyBases::BuildAnchors(GlobalState& gState)
+{
+    Configuration& config = gState.config;
+    StrategyBases& search = gState.Search;
+    int paths = config.RefinePaths < gState.Top.Count ? config.RefinePaths : gState.Top.Count;
+    if (paths <= 0) return;
+
+    const uint32_t listed = 0xFFFFFFFF;
+    int sharedStart = config.TotalThreads * config.MaxLocalSegments;
+    for (int segInd = sharedStart; segInd < sharedStart + gState.NSegments[config.TotalThreads]; segInd++)
+        gState.AllSegments[segInd]->refCount = 0;
+    for (int blockInd = 0; blockInd < gState.NBlocks[config.TotalThreads]; blockInd++)
+        gState.SharedBlocks[blockInd].tailSeg->refCount = blockInd + 1;
+
+    for (int rank = 0; rank < paths; rank++) {
+        Segment* curSeg = gState.SharedBlocks[gState.Top.Inx[rank]].tailSeg;
+        for (int up = 0; up < config.RefineSegments && curSeg->parent != 0; up++)
+            curSeg = curSeg->parent;
+        while (curSeg != 0 && curSeg->refCount == 0)
+            curSeg = curSeg->parent;
+        if (curSeg == 0 || curSeg->refCount == listed) continue;
+
+        search.anchors[search.NumAnchors++] = curSeg->refCount - 1;
+        curSeg->refCount = listed;
+    }
+}
+
+int StrategyBases::SelectAnchor(GlobalState& gState, uint64_t* seed)
+{
+    StrategyBases& search = gState.Search;
+    return search.NumAnchors > 0 ? search.anchors[Utils::xoro_r(seed) % search.NumAnchors] : -1;
+}
+
+void StrategyBases::RefineStatus(GlobalState& gState)
+{
+    gState.printer.printfQ("REFINE %d anchors\n", gState.Search.NumAnchors);
+}
@@ -3,13 +3,24 @@
 ThreadState::ThreadState(Configuration& config, GlobalState& gState, int id) : config(config), gState(gState)
 {
     Id = id;
-    Blocks = gState.AllBlocks + Id * config.MaxBlocks;
-    HashTab = gState.AllHashTabs + Id * config.MaxHashes;
+    Blocks = gState.LocalBlocks[Id];
+    HashTab = gState.LocalHashTabs[Id];
     RngSeed = (uint64_t)(Id + 173) * 5786766484692217813;
+    ShotSegmentLength = config.SegmentLength;
+    ShotStrategy = STRATEGY_SCATTERSHOT;
+    ChainCapacity = config.MaxSegments + 2;
+    Chain = (Segment**)malloc(ChainCapacity * sizeof(Segment*));
 
     printf("Thread %d\n", Id);
 }
 
+ThreadState::~ThreadState()
+{
+    Trace.Close();
+    free(NoveltyCache);
+    free(Chain);
+}
+
 void ThreadState::Initialize(Vec3d initTruncPos)
 {
     // Initial block
@@ -17,6 +28,8 @@ void ThreadState::Initialize(Vec3d initTruncPos)
     Blocks[0].tailSeg = (Segment*)malloc(sizeof(Segment)); //Instantiate root segment
     Blocks[0].tailSeg->numFrames = 0;
     Blocks[0].tailSeg->parent = NULL;
+    Blocks[0].tailSeg->seed = 0;
+    Blocks[0].tailSeg->coalesced = 0;
     Blocks[0].tailSeg->refCount = 0;
     Blocks[0].tailSeg->depth = 1;
 
@@ -26,87 +39,237 @@ void ThreadState::Initialize(Vec3d initTruncPos)
 
     HashTab[Blocks[0].pos.findNewHashInx(HashTab, config.MaxHashes)] = 0;
 
-    // Lightning
-    LightningLength = 0;
-    LightningLengthLocal = 0;
-    Lightning = (Vec3d*)malloc(sizeof(Vec3d) * config.MaxLightningLength);
-    LightningLocal = (Vec3d*)malloc(sizeof(Vec3d) * config.MaxLightningLength);
-
     // Synchronize global state
     gState.AllSegments[gState.NSegments[Id] + Id * config.MaxLocalSegments] = Blocks[0].tailSeg;
     gState.NSegments[Id]++;
     gState.NBlocks[Id]++;
 
+    if (gState.Novelty.Enabled())
+        NoveltyCache = (uint64_t*)calloc(NoveltyCacheMask + 1, sizeof(uint64_t));
+
+    if (config.RecordTrace) {
+        char traceName[256] = { 0 };
+        sprintf(traceName, "%s_trace_%d.bin", gState.OutputName, Id);
+        Trace.Open(traceName, config, Id);
+        Trace.Record(TRACE_INIT, initTruncPos, 0, 0, 0);
+    }
+
     LoopTimeStamp = omp_get_wtime();
 }
 
-bool ThreadState::SelectBaseBlock(int mainIteration)
+// In deterministic mode ShotsPerMerge counts shots over all threads, and the epoch's shots
+// are dealt out round-robin: thread Id fires those numbered Id, Id + TotalThreads, ...
+bool ThreadState::MergeDue(int shotsSinceMerge)
+{
+    if (config.Deterministic)
+        return Id + (long long)shotsSinceMerge * config.TotalThreads >= config.ShotsPerMerge;
+    return shotsSinceMerge >= config.ShotsPerMerge;
+}
+
+// A deterministic run reseeds every shot from its global number, so that a shot draws the
+// same base block and inputs whichever thread fires it. Together with the canonical merge
+// order (GlobalState::MergeBlocks) this makes the shared table after each merge a function
+// of the configuration alone, independent of thread count and timing.
+void ThreadState::BeginShot(int shotsSinceMerge)
 {
-    int origInx = gState.NBlocks[config.TotalThreads];
-    if (mainIteration % 15 == 0) {
+    if (!config.Deterministic) return;
+
+    ShotIndex = (long long)(gState.MergeCount - 1) * config.ShotsPerMerge + Id + (long long)shotsSinceMerge * config.TotalThreads;
+    RngSeed = (uint64_t)(ShotIndex + 173) * 5786766484692217813;
+}
+
+bool ThreadState::SelectBaseBlock(long long mainIteration)
+{
+    int origInx = gState.Search.Select(gState, &RngSeed);
+    ShotStrategy = origInx >= 0 ? gState.ActiveStrategy : STRATEGY_SCATTERSHOT;
+    if (origInx >= 0); // Chosen by the beam or refinement
+    else if (mainIteration % 15 == 0) {
         origInx = 0;
     }
-    else if (mainIteration % 7 == 1 && LightningLength > 0) {
-        for (int attempt = 0; attempt < 1000; attempt++) {
-            int randomLightInx = Utils::xoro_r(&RngSeed) % LightningLength;
-            origInx = Lightning[randomLightInx].findBlock(gState.SharedBlocks, gState.SharedHashTab, config.MaxSharedHashes, 0, gState.NBlocks[config.TotalThreads]);
-            if (origInx != gState.NBlocks[config.TotalThreads]) break;
-        }
-        if (origInx == gState.NBlocks[config.TotalThreads]) {
-            printf("Could not find lightning block, using root!\n");
-            origInx = 0;
-        }
+    else if (mainIteration % 7 == 1 && gState.LightningLength > 0) {
+        origInx = gState.Lightning[Utils::xoro_r(&RngSeed) % gState.LightningLength];
     }
     else {
-        int weighted = Utils::xoro_r(&RngSeed) % 5;
-        for (int attempt = 0; attempt < 100000; attempt++) {
-            origInx = Utils::xoro_r(&RngSeed) % gState.NBlocks[config.TotalThreads];
-            if (gState.SharedBlocks[origInx].tailSeg == 0) { printf("Chosen block tailseg null!\n"); continue; }
-            if (gState.SharedBlocks[origInx].tailSeg->depth == 0) { printf("Chosen block tailseg depth 0!\n"); continue; }
-            uint64_t s = gState.SharedBlocks[origInx].pos.s;
-            int normInfo = s % 900;
-            float xNorm = (float)((int)normInfo / 30);
-            float zNorm = (float)(normInfo % 30);
-            float approxXZSum = fabs((xNorm - 15) / 15) + fabs((zNorm - 15) / 15) + .01;
-            if (((float)(Utils::xoro_r(&RngSeed) % 50) / 100 < approxXZSum * approxXZSum) & (gState.SharedBlocks[origInx].tailSeg->depth < config.MaxSegments)) break;
-        }
-        if (origInx == gState.NBlocks[config.TotalThreads]) {
-            printf("Could not find block!\n");
+        origInx = gState.Sampler.Sample(&RngSeed);
+        if (origInx < 0) {
+            Printer::Warn(WARN_NO_BASE_BLOCK);
             return false;
         }
     }
 
     BaseBlock = gState.SharedBlocks[origInx];
-    if (BaseBlock.tailSeg->depth > config.MaxSegments + 2) { printf("BaseBlock depth above max!\n"); }
-    if (BaseBlock.tailSeg->depth == 0) { printf("BaseBlock depth is zero!\n"); }
+    if (BaseBlock.tailSeg->depth > config.MaxSegments + 2) { Printer::Warn(WARN_BASE_DEPTH_INVALID); }
+    if (BaseBlock.tailSeg->depth == 0) { Printer::Warn(WARN_BASE_DEPTH_INVALID); }
+
+    // Batched draws are recorded when they are fired, so that a shot's blocks follow its base.
+    if (config.BatchShots <= 1)
+        Trace.Record(TRACE_SELECT_BASE, BaseBlock.pos, origInx, 0, BaseBlock.value);
+    LogShot(origInx);
+    ShotSegmentLength = ChooseSegmentLength(origInx);
 
     return true;
 }
 
-void ThreadState::UpdateLightning(Vec3d stateBin)
+// Makes a shot drawn into a batch the current one again, as SelectBaseBlock left it.
+void ThreadState::ResumeShot(BatchShot& shot)
 {
-    if (!stateBin.truncEq(LightningLocal[LightningLengthLocal - 1])) {
-        if (LightningLengthLocal < config.MaxLightningLength) {
-            LightningLocal[LightningLengthLocal++] = stateBin;
-        }
-        else {
-            printf("Reached max lightning!\n");
-        }
+    BaseBlock = shot.base;
+    RngSeed = shot.rngSeed;
+    ShotSegmentLength = shot.segmentLength;
+    ShotStrategy = shot.strategy;
+    CurrentShot = shot.shotRecord;
+    Trace.Record(TRACE_SELECT_BASE, BaseBlock.pos, shot.baseInx, 0, BaseBlock.value);
+}
+
+// Queues the full local block buffer for the next merge and continues in a fresh one.
+// Blocks in the queued buffer can no longer be found locally, so a later copy of the same
+// bin goes into the new buffer as well; MergeBlocks keeps whichever has the higher value.
+void ThreadState::SpillBlocks()
+{
+    SpillQueue& spill = gState.Spills[Id];
+    if (spill.nBuffers == spill.bufferCapacity) {
+        spill.bufferCapacity = spill.bufferCapacity ? 2 * spill.bufferCapacity : 4;
+        spill.buffers = (Block**)realloc(spill.buffers, spill.bufferCapacity * sizeof(Block*));
+        spill.bufferBlocks = (int*)realloc(spill.bufferBlocks, spill.bufferCapacity * sizeof(int));
+    }
+    spill.buffers[spill.nBuffers] = Blocks;
+    spill.bufferBlocks[spill.nBuffers] = gState.NBlocks[Id];
+    spill.nBuffers++;
+    spill.spilledBlocks += gState.NBlocks[Id];
+
+    Blocks = (Block*)Memory::Alloc(config.MaxBlocks * sizeof(Block), Memory::CurrentNode());
+    gState.LocalBlocks[Id] = Blocks;
+    gState.NBlocks[Id] = 0;
+    memset(HashTab, 0xFF, config.MaxHashes * sizeof(int));
+}
+
+// Moves the thread's local segment list to its spill queue.
+void ThreadState::SpillSegments()
+{
+    SpillQueue& spill = gState.Spills[Id];
+    int nSegments = gState.NSegments[Id];
+    if (spill.nSegments + nSegments > spill.segmentCapacity) {
+        spill.segmentCapacity = 2 * (spill.nSegments + nSegments);
+        spill.segments = (Segment**)realloc(spill.segments, spill.segmentCapacity * sizeof(Segment*));
     }
+    memcpy(spill.segments + spill.nSegments, gState.AllSegments + Id * config.MaxLocalSegments, nSegments * sizeof(Segment*));
+    spill.nSegments += nSegments;
+    spill.spilledSegments += nSegments;
+    gState.NSegments[Id] = 0;
 }
 
+// Starts a record for the shot fired at shared block baseInx; MergeStats folds it into SharedStats.
+void ThreadState::LogShot(int baseInx)
+{
+    int& nShots = gState.NShots[Id];
+    int& capacity = gState.ShotLogCapacity[Id];
+    if (nShots == capacity) {
+        capacity = capacity ? 2 * capacity : 1024;
+        gState.ShotLogs[Id] = (ShotRecord*)realloc(gState.ShotLogs[Id], capacity * sizeof(ShotRecord));
+    }
+
+    CurrentShot = nShots;
+    ShotRecord& shot = gState.ShotLogs[Id][nShots++];
+    shot.baseInx = baseInx;
+    shot.policy = (uint8_t)gState.ActivePolicy;
+    shot.strategy = (uint8_t)ShotStrategy;
+    shot.discoveries = 0;
+    shot.improvements = 0;
+    shot.frames = 0;
+    shot.replayFrames = 0;
+    shot.branches = 0;
+    shot.failed = 0;
+    shot.exits = 0;
+    shot.exitFrames = 0;
+    shot.noveltyChecks = 0;
+    shot.noveltyHits = 0;
+    shot.framesSaved = 0;
+    shot.bestValue = -FLT_MAX;
+}
+
+void ThreadState::AddFrames(int nFrames, bool replay)
+{
+    if (CurrentShot >= gState.NShots[Id]) return;
+
+    ShotRecord& shot = gState.ShotLogs[Id][CurrentShot];
+    shot.frames += nFrames;
+    if (replay) shot.replayFrames += nFrames;
+}
+
+void ThreadState::LogBranch()
+{
+    if (CurrentShot < gState.NShots[Id]) gState.ShotLogs[Id][CurrentShot].branches++;
+}
+
+void ThreadState::LogFailure()
+{
+    if (CurrentShot < gState.NShots[Id]) gState.ShotLogs[Id][CurrentShot].failed = 1;
+}
+
+void ThreadState::LogExit(int frames)
+{
+    if (CurrentShot >= gState.NShots[Id]) return;
+    ShotRecord& shot = gState.ShotLogs[Id][CurrentShot];
+    shot.exits++;
+    shot.exitFrames += frames;
+}
+
+void ThreadState::LogNoveltyCheck(bool hit, int framesSaved)
+{
+    if (CurrentShot >= gState.NShots[Id]) return;
+    ShotRecord& shot = gState.ShotLogs[Id][CurrentShot];
+    shot.noveltyChecks++;
+    if (hit) {
+        shot.noveltyHits++;
+        shot.framesSaved += framesSaved;
+    }
+}
+
+// Sizes the shot's extensions at SegmentExitMultiple times the frames the base block's
+// recent extensions took to leave its bin, so that each crosses a few bins. Blocks whose
+// shots have stopped finding anything lie behind the frontier and get up to twice that.
+int ThreadState::ChooseSegmentLength(int baseInx)
+{
+    BlockStats& stats = gState.SharedStats[baseInx];
+    if (config.SegmentExitMultiple <= 0 || stats.exits == 0)
+        return config.SegmentLength;
+
+    float exitFrames = (float)stats.exitFrames / stats.exits;
+    float yieldRate = stats.shots > 0 ? (float)(stats.discoveries + stats.improvements) / stats.shots : 1;
+    if (yieldRate > 1) yieldRate = 1;
+    int length = (int)(exitFrames * config.SegmentExitMultiple * (2 - yieldRate) + 0.5f);
+    if (length < config.MinSegmentLength) length = config.MinSegmentLength;
+    if (length > config.MaxSegmentLength) length = config.MaxSegmentLength;
+    return length;
+}
+
+void ThreadState::LogVisit(int blockInx, float value)
+{
+    int& nVisits = gState.NVisits[Id];
+    int& capacity = gState.VisitLogCapacity[Id];
+    if (nVisits == capacity) {
+        capacity = capacity ? 2 * capacity : 1024;
+        gState.VisitLogs[Id] = (VisitRecord*)realloc(gState.VisitLogs[Id], capacity * sizeof(VisitRecord));
+    }
+    gState.VisitLogs[Id][nVisits++] = { blockInx, value };
+}
+
+// Takes the fine bin, since the partition may have changed since the base block was found.
 bool ThreadState::ValidateBaseBlock(Vec3d baseBlockStateBin)
 {
-    if (!BaseBlock.pos.truncEq(baseBlockStateBin)) {
-        printf("ORIG %d %d %d %ld AND BLOCK %d %d %d %ld NOT EQUAL\n",
+    if (!BaseBlock.pos.truncEq(Partition::Coarsen(baseBlockStateBin, Partition::Level(BaseBlock.pos)))) {
+        gState.printer.printfQ("ORIG %d %d %d %ld AND BLOCK %d %d %d %ld NOT EQUAL\n",
             baseBlockStateBin.x, baseBlockStateBin.y, baseBlockStateBin.z, baseBlockStateBin.s,
             BaseBlock.pos.x, BaseBlock.pos.y, BaseBlock.pos.z, BaseBlock.pos.s);
 
+        // Only the root segment (depth 1) may lack a parent.
         Segment* curSegDebug = BaseBlock.tailSeg;
         while (curSegDebug != 0) {  //inefficient but probably doesn't matter
-            if (curSegDebug->parent == 0)
-                printf("Parent is null!");
-            if (curSegDebug->parent->depth + 1 != curSegDebug->depth) { printf("Depths wrong"); }
+            if (curSegDebug->parent == 0) {
+                if (curSegDebug->depth != 1) Printer::Warn(WARN_SEGMENT_CHAIN_BROKEN);
+                break;
+            }
+            if (curSegDebug->parent->depth + 1 != curSegDebug->depth) { Printer::Warn(WARN_SEGMENT_CHAIN_BROKEN); }
             curSegDebug = curSegDebug->parent;
         }
 
@@ -116,61 +279,148 @@ bool ThreadState::ValidateBaseBlock(Vec3d baseBlockStateBin)
     return true;
 }
 
-void ThreadState::ProcessNewBlock(uint64_t prevRngSeed, int nFrames, Vec3d newPos, float newFitness)
+// Returns true if the block went into the local table, as a new bin or an improvement,
+// and if so copies it to *stored.
+bool ThreadState::ProcessNewBlock(uint64_t prevRngSeed, int nFrames, Vec3d newPos, float newFitness, Block* stored)
 {
     Block newBlock;
+    ShotRecord* shot = CurrentShot < gState.NShots[Id] ? &gState.ShotLogs[Id][CurrentShot] : NULL;
+
+    Trace.Record(TRACE_NEW_BLOCK, newPos, prevRngSeed, nFrames, newFitness);
+
+    // Hand off full buffers rather than drop the block.
+    if (gState.NBlocks[Id] == config.MaxBlocks)
+        SpillBlocks();
+    if (gState.NSegments[Id] == config.MaxLocalSegments)
+        SpillSegments();
 
     // Create and add block to list.
-    if (gState.NBlocks[Id] == config.MaxBlocks) {
-        printf("Max local blocks reached!\n");
+    //UPDATED FOR SEGMENTS STRUCT
+    newBlock = BaseBlock;
+    newBlock.pos = newPos;
+    newBlock.value = newFitness;
+    int blInxLocal = newPos.findBlock(Blocks, HashTab, config.MaxHashes, 0, gState.NBlocks[Id]);
+    int blInx = newPos.findBlock(gState.SharedBlocks, gState.SharedHashTab, config.MaxSharedHashes, 0, gState.NBlocks[config.TotalThreads]);
+
+    // Deterministic mode breaks value ties by BlockKey, and measures a shot's yield against
+    // the shared table alone, which every thread sees the same, rather than against
+    // whatever else its thread happened to find this epoch.
+    BlockKey newKey = { newFitness, BaseBlock.tailSeg->depth + 1, prevRngSeed, nFrames + 1 };
+    bool inShared = blInx < gState.NBlocks[config.TotalThreads];
+    bool beatsShared = inShared && (config.Deterministic
+        ? Block::Beats(newKey, gState.SharedBlocks[blInx].key())
+        : newBlock.value >= gState.SharedBlocks[blInx].value);
+    if (shot && config.Deterministic) {
+        if (!inShared) shot->discoveries++;
+        else if (beatsShared) shot->improvements++;
     }
-    else {
-        //UPDATED FOR SEGMENTS STRUCT
-        newBlock = BaseBlock;
-        newBlock.pos = newPos;
-        newBlock.value = newFitness;
-        int blInxLocal = newPos.findBlock(Blocks, HashTab, config.MaxHashes, 0, gState.NBlocks[Id]);
-        int blInx = newPos.findBlock(gState.SharedBlocks, gState.SharedHashTab, config.MaxSharedHashes, 0, gState.NBlocks[config.TotalThreads]);
-
-        if (blInxLocal < gState.NBlocks[Id]) { // Existing local block.
-            if (newBlock.value >= Blocks[blInxLocal].value) {
-                Segment* newSeg = (Segment*)malloc(sizeof(Segment));
-                newSeg->parent = BaseBlock.tailSeg;
-                newSeg->refCount = 0;
-                newSeg->numFrames = nFrames + 1;
-                newSeg->seed = prevRngSeed;
-                newSeg->depth = BaseBlock.tailSeg->depth + 1;
-                if (newSeg->depth == 0) { printf("newSeg depth is 0!\n"); }
-                if (BaseBlock.tailSeg->depth == 0) { printf("origBlock tailSeg depth is 0!\n"); }
-                newBlock.tailSeg = newSeg;
-                gState.AllSegments[Id * config.MaxLocalSegments + gState.NSegments[Id]] = newSeg;
-                gState.NSegments[Id] += 1;
-                Blocks[blInxLocal] = newBlock;
-            }
-        }
-        else if (blInx < gState.NBlocks[config.TotalThreads] && newBlock.value < gState.SharedBlocks[blInx].value);// Existing shared block but worse.
-        else { // Existing shared block and better OR completely new block.
-            HashTab[newPos.findNewHashInx(HashTab, config.MaxHashes)] = gState.NBlocks[Id];
+
+    // Sample by a hash of the candidate rather than a counter, so that deterministic runs
+    // sample the same visits at any thread count.
+    if (inShared && gState.Bins.Enabled()) {
+        uint64_t sample = (prevRngSeed ^ (uint64_t)nFrames) * 0x9E3779B97F4A7C15ULL;
+        if (((sample >> 40) & config.VisitSampleMask) == 0)
+            LogVisit(blInx, newFitness);
+    }
+
+    if (blInxLocal < gState.NBlocks[Id]) { // Existing local block.
+        if (config.Deterministic ? Block::Beats(newKey, Blocks[blInxLocal].key()) : newBlock.value >= Blocks[blInxLocal].value) {
             Segment* newSeg = (Segment*)malloc(sizeof(Segment));
             newSeg->parent = BaseBlock.tailSeg;
-            newSeg->refCount = 1;
+            newSeg->refCount = 0;
             newSeg->numFrames = nFrames + 1;
             newSeg->seed = prevRngSeed;
+            newSeg->coalesced = 0;
             newSeg->depth = BaseBlock.tailSeg->depth + 1;
-            if (newSeg->depth == 0) { printf("newSeg depth is 0!\n"); }
-            if (BaseBlock.tailSeg->depth == 0) { printf("origBlock tailSeg depth is 0!\n"); }
+            if (newSeg->depth == 0) { Printer::Warn(WARN_SEGMENT_DEPTH_ZERO); }
+            if (BaseBlock.tailSeg->depth == 0) { Printer::Warn(WARN_SEGMENT_DEPTH_ZERO); }
             newBlock.tailSeg = newSeg;
             gState.AllSegments[Id * config.MaxLocalSegments + gState.NSegments[Id]] = newSeg;
             gState.NSegments[Id] += 1;
-            Blocks[gState.NBlocks[Id]++] = newBlock;
+            Blocks[blInxLocal] = newBlock;
+            if (shot && !config.Deterministic) shot->improvements++;
+            if (shot && newFitness > shot->bestValue) shot->bestValue = newFitness;
+            if (stored) *stored = newBlock;
+            return true;
         }
     }
+    else if (inShared && !beatsShared);// Existing shared block but worse.
+    else { // Existing shared block and better OR completely new block.
+        HashTab[newPos.findNewHashInx(HashTab, config.MaxHashes)] = gState.NBlocks[Id];
+        Segment* newSeg = (Segment*)malloc(sizeof(Segment));
+        newSeg->parent = BaseBlock.tailSeg;
+        newSeg->refCount = 1;
+        newSeg->numFrames = nFrames + 1;
+        newSeg->seed = prevRngSeed;
+        newSeg->coalesced = 0;
+        newSeg->depth = BaseBlock.tailSeg->depth + 1;
+        if (newSeg->depth == 0) { Printer::Warn(WARN_SEGMENT_DEPTH_ZERO); }
+        if (BaseBlock.tailSeg->depth == 0) { Printer::Warn(WARN_SEGMENT_DEPTH_ZERO); }
+        newBlock.tailSeg = newSeg;
+        gState.AllSegments[Id * config.MaxLocalSegments + gState.NSegments[Id]] = newSeg;
+        gState.NSegments[Id] += 1;
+        Blocks[gState.NBlocks[Id]++] = newBlock;
+        if (shot && !config.Deterministic) {
+            if (inShared) shot->improvements++;
+            else shot->discoveries++;
+        }
+        if (shot && newFitness > shot->bestValue) shot->bestValue = newFitness;
+        if (stored) *stored = newBlock;
+        return true;
+    }
+
+    return false;
 }
 
 void ThreadState::PrintStatus(int mainIteration)
 {
     gState.printer.printfQ("\nThread ALL Loop %d blocks %d\n", mainIteration, gState.NBlocks[config.TotalThreads]);
     gState.printer.printfQ("LOAD %.3f RUN %.3f BLOCK %.3f TOTAL %.3f\n", LoadTime, RunTime, BlockTime, omp_get_wtime() - LoopTimeStamp);
+    gState.printer.printfQ("RESULTS queued %lld written %lld duplicate %lld\n",
+        gState.Results.Enqueued.load(), gState.Results.Written.load(), gState.Results.Duplicates.load());
+    if (gState.Novelty.Enabled()) {
+        long long run = gState.Novelty.FramesRun, saved = gState.Novelty.FramesSaved;
+        gState.printer.printfQ("NOVELTY checks %lld repeats %lld frames saved %.2f%% est. false positive rate %.2e clears %lld\n",
+            gState.Novelty.Checks, gState.Novelty.Hits, run + saved ? 100.0 * saved / (run + saved) : 0.0,
+            gState.Novelty.EstimatedFalsePositiveRate(), gState.Novelty.Clears);
+    }
+    for (int policy = 0; policy < POLICY_COUNT; policy++) {
+        if (gState.PolicyShots[policy] == 0) continue;
+        gState.printer.printfQ("POLICY %s shots %lld yield/shot %.3f yield/1k frames %.3f\n",
+            policy == POLICY_UCB ? "ucb" : "heuristic", gState.PolicyShots[policy],
+            (double)gState.PolicyYield[policy] / gState.PolicyShots[policy],
+            gState.PolicyFrames[policy] ? 1000.0 * gState.PolicyYield[policy] / gState.PolicyFrames[policy] : 0.0);
+    }
+    for (int strategy = 0; strategy < STRATEGY_COUNT; strategy++) {
+        if (gState.StrategyShots[strategy] == 0) continue;
+        double cpuHours = gState.StrategyTime[strategy] / 3600;
+        gState.printer.printfQ("STRATEGY %s shots %lld new blocks %lld cpu %.3f h, new blocks/cpu-h %.1f best value gain/cpu-h %.5f\n",
+            StrategyBases::Strategies[strategy].name, gState.StrategyShots[strategy], gState.StrategyDiscoveries[strategy], cpuHours,
+            cpuHours > 0 ? gState.StrategyDiscoveries[strategy] / cpuHours : 0.0, cpuHours > 0 ? gState.StrategyGain[strategy] / cpuHours : 0.0);
+    }
+    gState.Search.PrintStatus(gState);
+    if (gState.ActivePolicy == POLICY_UCB)
+        gState.printer.printfQ("UCB retired blocks %lld, weighted %d of %d\n", gState.RetiredBlocks, gState.Sampler.NumWeighted, gState.Sampler.NumBlocks);
+    if (gState.BatchedShots > 0) {
+        long long chainFrames = gState.BatchReplayFrames + gState.BatchSkippedFrames;
+        gState.printer.printfQ("BATCH shots %lld, replayed %.1f%% of their chain frames, %.1f per shot\n", gState.BatchedShots.load(),
+            chainFrames ? 100.0 * gState.BatchReplayFrames / chainFrames : 0.0, (double)gState.BatchReplayFrames / gState.BatchedShots);
+    }
+    if (gState.Faults + gState.Desyncs > 0)
+        gState.printer.printfQ("FAULTS %lld, desyncs %lld, emulator restarts %lld\n", gState.Faults.load(), gState.Desyncs.load(), gState.Restarts.load());
+    if (gState.Bins.Enabled())
+        gState.printer.printfQ("PARTITION split cells %d, splits %lld, merges %lld, folded %lld\n", gState.Bins.Splits, gState.Bins.TotalSplits, gState.Bins.TotalMerges, gState.Bins.TotalFolded);
+    if (gState.LightningLength > 0)
+        gState.printer.printfQ("LIGHTNING %d blocks on the paths of the top %d\n", gState.LightningLength, gState.LightningPaths);
+    if (config.BranchFanout > 0)
+        gState.printer.printfQ("BRANCH %lld branches, %.3f per shot\n", gState.Branches, gState.TotalShots ? (double)gState.Branches / gState.TotalShots : 0.0);
+    gState.printer.printfQ("SHARED blocks %d of %d, evicted %lld (%d last merge), dropped %lld, dropped segments %lld\n",
+        gState.NBlocks[config.TotalThreads], config.MaxSharedBlocks, gState.EvictedBlocks, gState.LastEvicted, gState.DroppedBlocks, gState.DroppedSegments);
+    gState.printer.printfQ("SPILLED blocks %lld (%lld last merge), segments %lld\n",
+        gState.SpilledBlocks, gState.Tuning.Epoch.spilledBlocks, gState.SpilledSegments);
+    if (Memory::LargePages != LARGE_PAGES_OFF)
+        Memory::ReportLargePages(gState.printer);
+    gState.printer.ReportWarnings();
     gState.printer.printfQ("\n\n");
 
     LoadTime = RunTime = BlockTime = 0;
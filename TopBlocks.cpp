@@ -0,0 +1,50 @@
+#include <Scattershot.hpp>
+
+TopBlocks::~TopBlocks()
+{
+    free(Inx);
+    free(Value);
+}
+
+void TopBlocks::Init(int capacity)
+{
+    Capacity = capacity;
+    Count = 0;
+    Inx = (int*)realloc(Inx, (capacity + 1) * sizeof(int));
+    Value = (float*)realloc(Value, (capacity + 1) * sizeof(float));
+}
+
+// Called whenever shared block blockInx is added or gets a new value. Values never go
+// down, though deterministic mode can replace a block with one of equal value, so a block
+// that does not make the list now was not on it before either, or is on it at that value.
+void TopBlocks::Offer(int blockInx, float value)
+{
+    if (Capacity == 0) return;
+    if (Count == Capacity && value <= Value[Count - 1]) return;
+
+    int n;
+    for (n = 0; n < Count; n++) {
+        if (Inx[n] == blockInx) {
+            memmove(Inx + n, Inx + n + 1, (Count - n - 1) * sizeof(int));
+            memmove(Value + n, Value + n + 1, (Count - n - 1) * sizeof(float));
+            Count--;
+            break;
+        }
+    }
+
+    // Ties go after the blocks already listed.
+    for (n = Count; n > 0 && Value[n - 1] < value; n--) {
+        Inx[n] = Inx[n - 1];
+        Value[n] = Value[n - 1];
+    }
+    Inx[n] = blockInx;
+    Value[n] = value;
+    if (Count < Capacity) Count++;
+}
+
+void TopBlocks::Rebuild(Block* blocks, int nBlocks)
+{
+    Count = 0;
+    for (int blockInd = 0; blockInd < nBlocks; blockInd++)
+        Offer(blockInd, blocks[blockInd].value);
+}
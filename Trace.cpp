@@ -0,0 +1,57 @@
+#include <Scattershot.hpp>
+
+void TraceRecorder::Open(const char* path, Configuration& config, int threadId)
+{
+    fp = fopen(path, "wb");
+    if (!fp) {
+        printf("Could not open trace file %s!\n", path);
+        return;
+    }
+
+    TraceHeader header;
+    memcpy(header.magic, "SSTR", 4);
+    header.version = Version;
+    header.threadId = threadId;
+    header.config = config;
+    fwrite(&header, sizeof(TraceHeader), 1, fp);
+
+    buffer = (TraceRecord*)malloc(BufferRecords * sizeof(TraceRecord));
+    nRecords = 0;
+}
+
+void TraceRecorder::Record(uint8_t op, Vec3d pos, uint64_t seed, int numFrames, float value)
+{
+    if (!fp) return;
+
+    TraceRecord& rec = buffer[nRecords++];
+    rec.op = op;
+    rec.numFrames = (uint16_t)numFrames;
+    rec.x = pos.x;
+    rec.y = pos.y;
+    rec.z = pos.z;
+    rec.s = pos.s;
+    rec.seed = seed;
+    rec.value = value;
+
+    if (nRecords == BufferRecords)
+        Flush();
+}
+
+void TraceRecorder::Flush()
+{
+    if (!fp) return;
+
+    fwrite(buffer, sizeof(TraceRecord), nRecords, fp);
+    nRecords = 0;
+}
+
+void TraceRecorder::Close()
+{
+    if (!fp) return;
+
+    Flush();
+    fclose(fp);
+    free(buffer);
+    fp = NULL;
+    buffer = NULL;
+}
@@ -0,0 +1,78 @@
+#include <Scattershot.hpp>
+
+// Called at the end of MergeState, after MergeStats has filled in the epoch's shots and table fill.
+void Tuner::Update(GlobalState& gState, double mergeStart, double gcTime)
+{
+    Configuration& config = gState.config;
+    double now = omp_get_wtime();
+
+    Epoch.epochTime = lastMergeEnd > 0 ? mergeStart - lastMergeEnd : 0;
+    Epoch.mergeTime = now - mergeStart - gcTime + gState.Sampler.RebuildTime;
+    Epoch.gcTime = gcTime;
+    lastMergeEnd = now;
+
+    // The first merge follows no epoch. Deterministic runs cannot depend on timings.
+    if (config.TuneMode == TUNE_OFF || config.Deterministic || Epoch.epochTime <= 0 || Epoch.shots == 0)
+        return;
+
+    double totalTime = Epoch.epochTime + Epoch.mergeTime + Epoch.gcTime;
+    BlocksPerSecond = Epoch.newBlocks / totalTime;
+
+    // Full local tables spill rather than drop blocks, so only merge cost bounds the epoch.
+    double mergeOverhead = Epoch.mergeTime / totalTime;
+    if (mergeOverhead > MaxMergeOverhead)
+        Adjust(gState, "ShotsPerMerge", config.ShotsPerMerge, config.ShotsPerMerge * 5 / 4 + 1,
+            config.MinShotsPerMerge, config.MaxShotsPerMerge, "merge overhead", mergeOverhead);
+    else if (mergeOverhead < MinMergeOverhead)
+        Adjust(gState, "ShotsPerMerge", config.ShotsPerMerge, config.ShotsPerMerge * 4 / 5,
+            config.MinShotsPerMerge, config.MaxShotsPerMerge, "merge overhead", mergeOverhead);
+
+    // Replaying the base block's chain is paid once per shot and amortized over its segments.
+    double replayFraction = Epoch.frames ? (double)Epoch.replayFrames / Epoch.frames : 0;
+    if (replayFraction > MaxReplayFraction)
+        Adjust(gState, "SegmentsPerShot", config.SegmentsPerShot, config.SegmentsPerShot * 5 / 4 + 1,
+            config.MinSegmentsPerShot, config.MaxSegmentsPerShot, "replay fraction", replayFraction);
+    else if (replayFraction < MinReplayFraction)
+        Adjust(gState, "SegmentsPerShot", config.SegmentsPerShot, config.SegmentsPerShot * 4 / 5,
+            config.MinSegmentsPerShot, config.MaxSegmentsPerShot, "replay fraction", replayFraction);
+
+    // GC only runs every MergesPerSegmentGC merges, so spread its cost over them.
+    if (Epoch.sharedSegmentFill > MaxSharedSegmentFill)
+        Adjust(gState, "MergesPerSegmentGC", config.MergesPerSegmentGC, config.MergesPerSegmentGC - 1,
+            config.MinMergesPerSegmentGC, config.MaxMergesPerSegmentGC, "shared segment fill", Epoch.sharedSegmentFill);
+    else if (gcTime > 0 && gcTime / (totalTime * config.MergesPerSegmentGC) > MaxGCOverhead)
+        Adjust(gState, "MergesPerSegmentGC", config.MergesPerSegmentGC, config.MergesPerSegmentGC + 1,
+            config.MinMergesPerSegmentGC, config.MaxMergesPerSegmentGC, "GC overhead", gcTime / (totalTime * config.MergesPerSegmentGC));
+
+    if (config.SegmentExitMultiple > 0)
+        return;
+
+    // Turn around whenever the last step made things clearly worse, or when a bound is hit.
+    if (lastClimbRate > 0 && BlocksPerSecond < lastClimbRate * (1 - ClimbDeadBand))
+        climbDirection = -climbDirection;
+    int lengthStep = config.SegmentLength / 8 > 1 ? config.SegmentLength / 8 : 1;
+    int newLength = config.SegmentLength + climbDirection * lengthStep;
+    if (newLength < config.MinSegmentLength || newLength > config.MaxSegmentLength) {
+        climbDirection = -climbDirection;
+        newLength = config.SegmentLength + climbDirection * lengthStep;
+    }
+    Adjust(gState, "SegmentLength", config.SegmentLength, newLength,
+        config.MinSegmentLength, config.MaxSegmentLength, "blocks/s", BlocksPerSecond);
+    lastClimbRate = BlocksPerSecond;
+}
+
+void Tuner::Adjust(GlobalState& gState, const char* name, int& value, int target, int lo, int hi, const char* reason, double measure)
+{
+    if (target < lo) target = lo;
+    if (target > hi) target = hi;
+    if (target == value) return;
+
+    if (gState.config.TuneMode == TUNE_DRY_RUN) {
+        gState.printer.printfQ("TUNE recommend %s %d -> %d (%s %.3f)\n", name, value, target, reason, measure);
+        return;
+    }
+
+    gState.printer.printfQ("TUNE %s %d -> %d (%s %.3f)\n", name, value, target, reason, measure);
+    value = target;
+    Adjustments++;
+}
@@ -1,5 +1,123 @@
 #include <Utils.hpp>
 
+const char* Printer::WarningNames[WARN_COUNT] = {
+    "Failed to find new hash index after 100 tries",
+    "Failed to find block from hash after 100 tries",
+    "Segment depth is 0",
+    "Segment chain broken (null parent or wrong depth)",
+    "Chosen block tailseg null",
+    "Chosen block tailseg depth 0",
+    "Could not find base block",
+    "Base block depth zero or above max",
+    "Reached max lightning"
+};
+
+Printer::WarningRow Printer::WarningCounts[Printer::MaxThreads];
+
+void Printer::Start(int nThreads)
+{
+    if (nThreads > MaxThreads) nThreads = MaxThreads;
+    for (int i = 0; i < nThreads; i++)
+        rings[i] = new LockFreeQueue<LogLine>(RingCapacity);
+
+    running = true;
+    flusher = std::thread([this]() { Run(); });
+}
+
+void Printer::Stop()
+{
+    if (!running) return;
+
+    running = false;
+    flusher.join();
+
+    for (int i = 0; i < MaxThreads; i++) {
+        delete rings[i];
+        rings[i] = NULL;
+    }
+
+    if (gLogFP) fclose(gLogFP);
+    gLogFP = NULL;
+}
+
+void Printer::WriteLine(LogLine& line)
+{
+    if (gPrint) fwrite(line.text, 1, line.length, stdout);
+    if (gLog) {
+        if (!gLogFP) {
+            char logName[256] = { 0 };
+            sprintf(logName, "%s_log.txt", gProgName);
+            gLogFP = fopen(logName, "a");
+        }
+        if (gLogFP) fwrite(line.text, 1, line.length, gLogFP);
+    }
+}
+
+void Printer::Run()
+{
+    LogLine line;
+
+    for (;;) {
+        int written = 0;
+        for (int i = 0; i < MaxThreads; i++) {
+            if (!rings[i]) continue;
+            while (rings[i]->TryPop(line)) {
+                WriteLine(line);
+                written++;
+            }
+        }
+
+        if (flushRequested.exchange(false)) {
+            fflush(stdout);
+            if (gLogFP) fflush(gLogFP);
+        }
+
+        if (written == 0) {
+            // Drain whatever was queued before Stop() before exiting.
+            if (!running) break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+    }
+
+    fflush(stdout);
+    if (gLogFP) fflush(gLogFP);
+}
+
+void Printer::ReportWarnings()
+{
+    for (int w = 0; w < WARN_COUNT; w++) {
+        long long total = 0;
+        for (int i = 0; i < MaxThreads; i++)
+            total += WarningCounts[i].counts[w].load(std::memory_order_relaxed);
+
+        if (total > reported[w]) {
+            printfQ("WARNING %s: %lld since last status (%lld total)\n", WarningNames[w], total - reported[w], total);
+            reported[w] = total;
+        }
+    }
+}
+
+// Only faults raised by code in the emulator's image are handled. Anything else, such as a
+// bug in the search itself, goes on to the next handler and stops the process as before.
+static int EmulatorFaultFilter(EXCEPTION_POINTERS* info, uintptr_t imageBase, size_t imageSize)
+{
+    uintptr_t address = (uintptr_t)info->ExceptionRecord->ExceptionAddress;
+    return address - imageBase < imageSize ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH;
+}
+
+// Kept apart from any C++ object, which MSVC does not allow in a function with __try.
+bool Utils::Guarded(void (*fn)(void*), void* context, const void* imageBase, size_t imageSize, unsigned long* exceptionCode)
+{
+    __try {
+        fn(context);
+    }
+    __except (EmulatorFaultFilter(GetExceptionInformation(), (uintptr_t)imageBase, imageSize)) {
+        *exceptionCode = GetExceptionCode();
+        return false;
+    }
+    return true;
+}
+
 const char Dll::dataMap[8192] = "  0 ...........................X...........XX.XXX.X....................................................."
 "  1 ...................................................................................................."
 "  2 ...................................................................................................."
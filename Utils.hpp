@@ -9,12 +9,17 @@
 #include <winbase.h>
 #include <stdarg.h>
 #include <stdint.h>
+#include <atomic>
+#include <thread>
+#include "LockFreeQueue.hpp"
+#include "Memory.hpp"
 
 #ifndef _USE_MATH_DEFINES
 #define _USE_MATH_DEFINES
 #endif
 
 #include <math.h>
+#include <float.h>
 
 #ifndef UTILS_H
 #define UTILS_H
@@ -44,35 +49,6 @@ public:
         return rotl(s0 * 0x9E3779BB, 5) * 5;
     }
 
-    static void writeFile(char* newFile, const char* base, Input* inputs, int offset, int length) {
-        FILE* fp0 = fopen(newFile, "rb");
-        if (fp0 != NULL)
-        {
-            fclose(fp0);
-            return;
-        }
-
-        FILE* fp1 = fopen(base, "rb");
-        FILE* fp2 = fopen(newFile, "wb");
-        Input in;
-        int i;
-
-        for (i = 0; i < 0x400 + offset * 4; i++) {
-            unsigned char a;
-            fread(&a, 1, 1, fp1);
-            fwrite(&a, 1, 1, fp2);
-        }
-
-        for (i = 0; i < length; i++) {
-            in = inputs[i];
-            in.b = (in.b >> 8) | (in.b << 8); // Fuck me endianness
-            fwrite(&in, sizeof(Input), 1, fp2);
-        }
-
-        fclose(fp1);
-        fclose(fp2);
-    }
-
     static void copyDll(char* newFile, char* base) {
         FILE* fp1 = fopen(base, "rb");
         FILE* fp2 = fopen(newFile, "wb");
@@ -92,6 +68,18 @@ public:
         }
     }
 
+    // Runs fn under a structured exception handler, so that an access violation or other
+    // fault in code within [imageBase, imageBase + imageSize), the emulator DLL, comes back
+    // as false (with its code) instead of killing the process. Nothing between here and the
+    // fault is unwound, so fn must not own objects with destructors.
+    static bool Guarded(void (*fn)(void*), void* context, const void* imageBase, size_t imageSize, unsigned long* exceptionCode);
+
+    template <typename F>
+    static bool TryRun(F& func, const void* imageBase, size_t imageSize, unsigned long* exceptionCode)
+    {
+        return Guarded([](void* context) { (*(F*)context)(); }, &func, imageBase, imageSize, exceptionCode);
+    }
+
     template <typename F>
     static void SingleThread(F func)
     {
@@ -105,25 +93,41 @@ public:
         return;
     }
 
-    static Input* GetM64(const char* path)
+    // Maps the m64 and decodes every input after the 0x400 byte header in one pass.
+    // The caller owns the returned buffer.
+    static Input* GetM64(const char* path, int* length = NULL)
     {
-        Input in;
-        int length = 83600;
-        size_t inputSize = sizeof(Input);
-        size_t fileSize = inputSize * length;
-        Input* fileInputs = (Input*)malloc(fileSize);
+        HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE) {
+            printf("Could not open m64 %s!\n", path);
+            return NULL;
+        }
 
-        FILE* fp = fopen(path, "rb");
-        fseek(fp, 0x400, SEEK_SET);
+        LARGE_INTEGER fileSize;
+        GetFileSizeEx(file, &fileSize);
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        const Input* mapped = mapping ? (const Input*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+        if (!mapped) {
+            printf("Could not map m64 %s!\n", path);
+            if (mapping) CloseHandle(mapping);
+            CloseHandle(file);
+            return NULL;
+        }
 
-        for (int i = 0; i < length; i++) {
-            fread(&in, inputSize, 1, fp);
+        int nInputs = fileSize.QuadPart > 0x400 ? (int)((fileSize.QuadPart - 0x400) / sizeof(Input)) : 0;
+        Input* fileInputs = (Input*)malloc((nInputs > 0 ? nInputs : 1) * sizeof(Input));
+        const Input* src = (const Input*)((const char*)mapped + 0x400);
+        for (int i = 0; i < nInputs; i++) {
+            Input in = src[i];
             in.b = (in.b >> 8) | (in.b << 8); // Fuck me endianness
             fileInputs[i] = in;
         }
 
-        fclose(fp);
+        UnmapViewOfFile(mapped);
+        CloseHandle(mapping);
+        CloseHandle(file);
 
+        if (length) *length = nInputs;
         return fileInputs;
     }
 };
@@ -135,6 +139,7 @@ class Dll
 public:
     HMODULE hdll;
     int dataStart, dataLength, bssStart, bssLength;
+    size_t imageSize;
 
     static const char dataMap[8192];
     static const char bssMap[8192];
@@ -149,6 +154,7 @@ public:
 
         IMAGE_NT_HEADERS* pNtHdr = ImageNtHeader(hdll);
         IMAGE_SECTION_HEADER* pSectionHdr = (IMAGE_SECTION_HEADER*)(pNtHdr + 1);
+        imageSize = pNtHdr->OptionalHeader.SizeOfImage;
 
         for (int i = 0; i < pNtHdr->FileHeader.NumberOfSections; i++) {
             char* name = (char*)pSectionHdr->Name;
@@ -172,19 +178,20 @@ public:
     void* data;
     void* bss;
 
+    // Allocated on the calling thread's NUMA node, which is where the state gets loaded.
     void allocState(Dll& dll) {
-        data = calloc(dll.dataLength, 1);
-        bss = calloc(dll.bssLength, 1);
+        data = Memory::Alloc(dll.dataLength, Memory::CurrentNode());
+        bss = Memory::Alloc(dll.bssLength, Memory::CurrentNode());
     }
 
     void allocStateSmall(Dll& dll) {
-        data = calloc(10000, 1);
-        bss = calloc(dll.bssLength, 1);
+        data = Memory::Alloc(10000, Memory::CurrentNode());
+        bss = Memory::Alloc(dll.bssLength, Memory::CurrentNode());
     }
 
     void freeState() {
-        free(data);
-        free(bss);
+        Memory::Free(data);
+        Memory::Free(bss);
         data = bss = NULL;
     }
 
@@ -224,6 +231,27 @@ public:
         memcpy((char*)dll.hdll + dll.bssStart + 4742000, (char*)bss + 4742000, 1000);
     }
 
+    // Copies a state saved from another instance of the same DLL. Every instance is
+    // loaded at its own base address, so any pointer-sized word that points into the
+    // source image is moved by the same offset into the destination image.
+    void copyRebased(SaveState& src, Dll& srcDll, Dll& dstDll) {
+        memcpy(data, src.data, srcDll.dataLength);
+        memcpy(bss, src.bss, srcDll.bssLength);
+
+        uintptr_t srcBase = (uintptr_t)srcDll.hdll;
+        uintptr_t srcEnd = srcBase + srcDll.imageSize;
+        intptr_t delta = (intptr_t)((uintptr_t)dstDll.hdll - srcBase);
+
+        uintptr_t* words[2] = { (uintptr_t*)data, (uintptr_t*)bss };
+        int nWords[2] = { srcDll.dataLength / (int)sizeof(uintptr_t), srcDll.bssLength / (int)sizeof(uintptr_t) };
+        for (int r = 0; r < 2; r++) {
+            for (int i = 0; i < nWords[r]; i++) {
+                if (words[r][i] >= srcBase && words[r][i] < srcEnd)
+                    words[r][i] += delta;
+            }
+        }
+    }
+
     void save(Dll& dll) {
         memcpy((char*)data, (char*)dll.hdll + dll.dataStart, dll.dataLength);
         memcpy((char*)bss, (char*)dll.hdll + dll.bssStart, dll.bssLength);
@@ -242,33 +270,98 @@ public:
     }
 };
 
+// Repeated diagnostics from hot paths. These are counted per thread instead of
+// printed, and Printer::ReportWarnings summarizes them with the status output.
+enum Warning
+{
+    WARN_NEW_HASH_FAILED,
+    WARN_FIND_BLOCK_FAILED,
+    WARN_SEGMENT_DEPTH_ZERO,
+    WARN_SEGMENT_CHAIN_BROKEN,
+    WARN_CHOSEN_TAILSEG_NULL,
+    WARN_CHOSEN_DEPTH_ZERO,
+    WARN_NO_BASE_BLOCK,
+    WARN_BASE_DEPTH_INVALID,
+    WARN_MAX_LIGHTNING,
+    WARN_COUNT
+};
+
+typedef struct {
+    char text[248];
+    int length;
+} LogLine;
+
+// Messages are formatted on the calling thread into that thread's ring and written
+// to stdout and the log file by a single background flusher, so logging never
+// blocks a worker on console or disk I/O. A thread only waits if its own ring is
+// full, which status output alone should never cause; anything that can repeat on
+// a hot path belongs in Warn() instead.
 class Printer
 {
 public:
+    static const int MaxThreads = 64;
+    static const int RingCapacity = 1024;
+
     int gPrint = 1, gLog = 1;
     char gProgName[192] = { 0 };
     FILE* gLogFP = NULL;
 
+    static const char* WarningNames[WARN_COUNT];
+    struct alignas(64) WarningRow { std::atomic<long long> counts[WARN_COUNT]; };
+    static WarningRow WarningCounts[MaxThreads];
+
+    Printer()
+    {
+        for (int i = 0; i < MaxThreads; i++)
+            rings[i] = NULL;
+    }
+
+    ~Printer()
+    {
+        Stop();
+    }
+
+    // Lock-free: each thread only ever touches its own row.
+    static void Warn(Warning warning)
+    {
+        std::atomic<long long>& count = WarningCounts[omp_get_thread_num() % MaxThreads].counts[warning];
+        count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
     void printfQ(const char* format, ...) {
+        if (!gPrint && !gLog) return;
+
+        LogLine line;
         va_list args;
         va_start(args, format);
-        if (gPrint) vprintf(format, args);
-        if (gLog) {
-            if (!gLogFP) {
-                char logName[256] = { 0 };
-                sprintf(logName, "%s_log.txt", gProgName);
-                gLogFP = fopen(logName, "a");
-            }
-            vfprintf(gLogFP, format, args);
-        }
+        line.length = vsnprintf(line.text, sizeof(line.text), format, args);
         va_end(args);
+        if (line.length < 0) return;
+        if (line.length >= (int)sizeof(line.text)) line.length = sizeof(line.text) - 1;
+
+        if (!running) {
+            WriteLine(line);
+            return;
+        }
+
+        LockFreeQueue<LogLine>* ring = rings[omp_get_thread_num() % MaxThreads];
+        if (!ring) {
+            WriteLine(line);
+            return;
+        }
+        while (!ring->TryPush(line))
+            std::this_thread::yield();
     }
 
+    // Ask the flusher to push buffered output to disk; does not block.
     void flushLog() {
-        fclose(gLogFP);
-        gLogFP = NULL;
+        flushRequested = true;
     }
 
+    void ReportWarnings();
+    void Start(int nThreads);
+    void Stop();
+
     void ParseArgs(int argc, char* argv[])
     {
         strncpy(gProgName, argv[0], 128);
@@ -282,6 +375,16 @@ public:
         }
         printf("Not checking further args.\n");
     }
+
+private:
+    LockFreeQueue<LogLine>* rings[MaxThreads];
+    std::thread flusher;
+    std::atomic<bool> running{ false };
+    std::atomic<bool> flushRequested{ false };
+    long long reported[WARN_COUNT] = { 0 };
+
+    void WriteLine(LogLine& line);
+    void Run();
 };
 
 
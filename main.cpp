@@ -7,18 +7,317 @@ void InitConfiguration(Configuration& configuration)
     configuration.StartFrame = 3545;
     configuration.SegmentLength = 10;
     configuration.MaxSegments = 1024;
-    configuration.MaxBlocks = 500000;
+    configuration.MaxBlocks = 50000;
     configuration.MaxHashes = 10 * configuration.MaxBlocks;
     configuration.MaxSharedBlocks = 20000000;
     configuration.MaxSharedHashes = 10 * configuration.MaxSharedBlocks;
     configuration.TotalThreads = 4;
     configuration.MaxSharedSegments = 25000000;
-    configuration.MaxLocalSegments = 2000000;
+    configuration.MaxLocalSegments = 200000;
     configuration.MaxLightningLength = 10000;
     configuration.MaxShots = 1000000000;
     configuration.SegmentsPerShot = 200;
     configuration.ShotsPerMerge = 300;
     configuration.MergesPerSegmentGC = 10;
+    // Features added to the original search default to off.
+    configuration.RecordTrace = 0;
+    configuration.ResultArchive = 0;
+    configuration.NoveltyFilterLogBits = 0;
+    configuration.NoveltyCheckInterval = 1;
+    configuration.NoveltyMaxFalsePositive = 0.05;
+    configuration.SelectionPolicy = POLICY_HEURISTIC;
+    configuration.UcbExploration = 0.5;
+    configuration.RetireAfterShots = 50;
+    configuration.TuneMode = TUNE_OFF;
+    configuration.MinSegmentsPerShot = 20;
+    configuration.MaxSegmentsPerShot = 2000;
+    configuration.MinShotsPerMerge = 30;
+    configuration.MaxShotsPerMerge = 3000;
+    configuration.MinSegmentLength = 4;
+    configuration.MaxSegmentLength = 40;
+    configuration.MinMergesPerSegmentGC = 2;
+    configuration.MaxMergesPerSegmentGC = 50;
+    configuration.LargePages = LARGE_PAGES_OFF;
+    configuration.EvictHighWatermark = 0.9;
+    configuration.EvictLowWatermark = 0.8;
+    configuration.Deterministic = 0;
+    configuration.RestartAfterFaults = 3;
+    configuration.BranchFanout = 0;
+    configuration.TopK = 0;
+    configuration.ExportInterval = 100;
+    configuration.MaxSplitLevel = 0;
+    configuration.MaxSplits = 100000;
+    configuration.SplitVisits = 32;
+    configuration.SplitSpread = 0.002;
+    configuration.MergeColdAfter = 50;
+    configuration.VisitSampleMask = 15;
+    configuration.SegmentExitMultiple = 0;
+    configuration.CoalesceSegments = 0;
+    configuration.LightningPaths = 0;
+    configuration.SnapshotInterval = 0;
+    configuration.Strategy = STRATEGY_SCATTERSHOT;
+    configuration.StrategyMerges = 20;
+    configuration.BeamWidth = 64;
+    configuration.RefinePaths = 10;
+    configuration.RefineSegments = 4;
+    configuration.BatchShots = 0;
+    configuration.ReplayStackStates = 0;
+}
+
+// One of the independent searches a run hosts, with its own configuration, start m64 and
+// tables. The targets share the threads and their emulator instances, which run one
+// target's epoch at a time, the one furthest behind its Share of the run's time.
+class SearchTarget
+{
+public:
+    char Name[32];
+    const char* M64Path;
+    Configuration config;
+    int Share;
+    Objective objective = { NULL, NULL };  // The route's own binning and fitness unless set
+    GlobalState* gState = NULL;
+    Input* FileInputs = NULL;
+    double UsedTime = 0;  // Wall time of its epochs and merges
+    std::atomic<bool> Exhausted{ false };  // Some thread ran out of shots or base blocks
+    bool Finished = false;                 // Decided from Exhausted once all threads are back
+};
+
+static const int MaxTargets = 8;
+
+// Each target starts from a copy of the base configuration and may change anything but
+// TotalThreads. The tables are sized per target, so when hosting several, cut MaxBlocks,
+// MaxSharedBlocks and MaxSharedSegments down to share the memory one target would use.
+// A target can also bin and score states its own way through its objective; it shares
+// the rest of the route's Script, such as ValidateBlock and the results it writes.
+int InitTargets(Configuration& base, SearchTarget* targets)
+{
+    strcpy(targets[0].Name, "main");
+    targets[0].M64Path = "C:\\Users\\Tyler\\Documents\\repos\\scattershot\\x64\\Debug\\4_units_from_edge.m64";
+    targets[0].config = base;
+    targets[0].Share = 1;
+    return 1;
+}
+
+// The target with the least time for its share, or -1 once all are finished.
+int PickTarget(SearchTarget* targets, int nTargets)
+{
+    int pick = -1;
+    for (int n = 0; n < nTargets; n++) {
+        if (targets[n].Finished) continue;
+        if (pick < 0 || targets[n].UsedTime * targets[pick].Share < targets[pick].UsedTime * targets[n].Share)
+            pick = n;
+    }
+    return pick;
+}
+
+// A thread's emulator instance, with the scratch states every target's shots use on it.
+typedef struct {
+    Dll* dll;
+    SaveState* state2;
+    SaveState* state3;
+    int consecutiveFaults;
+} Emulator;
+
+// What a thread keeps for one target: its ThreadState and Script, the target's start
+// state on the thread's instance, and where its shot loop stands. Shots reload only the
+// ranges riskyLoadJ covers from state; the rest of memory stays as it was after the
+// advance to the start, which advanced holds.
+class TargetThread
+{
+public:
+    SearchTarget& target;
+    Configuration& config;
+    GlobalState& gState;
+    ThreadState tState;
+    Script script;
+    SaveState state;
+    SaveState advanced;
+    ShotBatch batch;
+    Input* m64Diff;
+    int mainIteration = 0;
+    int shotsSinceMerge = 0;
+
+    TargetThread(SearchTarget& target, int id, Dll& dll)
+        : target(target), config(target.config), gState(*target.gState), tState(target.config, *target.gState, id), script(target.config, *target.gState, tState, dll, target.objective)
+    {
+        state.allocState(dll);
+        advanced.allocState(dll);
+        batch.Init(config, dll);
+        m64Diff = (Input*)malloc(sizeof(Input) * ((config.TuneMode != TUNE_OFF || config.SegmentExitMultiple > 0 || config.CoalesceSegments ? config.MaxSegmentLength : config.SegmentLength) * config.MaxSegments + 256)); // Todo: Nasty
+    }
+
+    ~TargetThread()
+    {
+        state.freeState();
+        advanced.freeState();
+        free(m64Diff);
+    }
+
+    // Puts the instance back in the state the target's chains replay from, after a fault
+    // or a restart has left memory outside riskyLoadJ's ranges dirty.
+    void Restore(Dll& dll)
+    {
+        advanced.load(dll);
+        tState.LoadTime += state.riskyLoadJ(dll);
+    }
+
+    // Takes the instance over from another target. Shots only reload the ranges the game
+    // writes, so the rest of memory has to come from this target's advance as well.
+    void Resume(Dll& dll)
+    {
+        Restore(dll);
+        tState.LoopTimeStamp = omp_get_wtime();
+    }
+
+    bool RunEpoch(Emulator& emu, int nTargets);
+};
+
+// Merges, then fires shots until the next merge is due. Must be called by every thread of
+// the parallel region. Returns false once this thread has run its shots or found no base
+// block to fire from, always after the epoch's merge; the target ends when any thread has.
+//
+// Counts shots since the last merge rather than testing mainIteration, so that the
+// tuner can change ShotsPerMerge between merges. Threads fire unequal numbers of
+// shots per epoch in deterministic mode, so there the run ends on a merge count
+// that every thread agrees on.
+bool TargetThread::RunEpoch(Emulator& emu, int nTargets)
+{
+    Dll& dll = *emu.dll;
+    SaveState& state2 = *emu.state2;
+    SaveState& state3 = *emu.state3;
+    Printer& printer = gState.printer;
+    VOIDFUNC sm64_init = (VOIDFUNC)GetProcAddress(dll.hdll, "sm64_init");
+
+    bool merged = false;
+    for (;; mainIteration++) {
+        // ALWAYS START WITH A MERGE SO THE SHARED BLOCKS ARE OK.
+        if (mainIteration == 0 || tState.MergeDue(shotsSinceMerge)) {
+            // The next epoch may go to another target, which then merges first.
+            if (merged)
+                return true;
+            merged = true;
+
+            shotsSinceMerge = 0;
+            tState.Trace.Record(TRACE_MERGE, tState.BaseBlock.pos, mainIteration, gState.SegmentGCDue(), 0);
+            Utils::SingleThread([&]()
+                { 
+                    if (nTargets > 1)
+                        printer.printfQ("\nTARGET %s\n", target.Name);
+                    gState.MergeState();
+                    tState.PrintStatus(mainIteration);
+                });
+            gState.Sampler.Rebuild(gState);
+            if (gState.SnapshotDue())
+                gState.Snapshot.Publish(gState);
+            if (gState.ExportDue())
+                script.ExportTopBlocks(advanced, state, m64Diff);
+
+            if (config.Deterministic && (long long)(gState.MergeCount - 1) * config.ShotsPerMerge > config.MaxShots)
+                return false;
+        }
+
+        // Only after the merge, which every thread has to reach.
+        if (!config.Deterministic && mainIteration > config.MaxShots)
+            return false;
+
+        // Deterministic mode can leave a thread without a shot in this epoch.
+        if (tState.MergeDue(shotsSinceMerge))
+            continue;
+
+        // Pick a block to "fire a scattershot" at. Batching draws the epoch's next few
+        // at once and fires them in chain order.
+        if (batch.Enabled()) {
+            if (batch.Fired == batch.Count && !batch.Draw(tState, shotsSinceMerge, mainIteration))
+                return false;
+            tState.ResumeShot(batch.Next());
+            shotsSinceMerge++;
+        }
+        else {
+            tState.BeginShot(shotsSinceMerge++);
+            if (!tState.SelectBaseBlock(config.Deterministic ? tState.ShotIndex : mainIteration))
+                return false;
+        }
+
+        // Run the shot under a fault handler, so that a crash in the emulator or a chain
+        // that no longer reproduces its block costs this shot and nothing else. The base
+        // block is marked failed so it is not drawn again, and the instance is restored,
+        // since a crash can leave memory outside riskyLoadJ's ranges dirty.
+        bool desynced = false;
+        auto fireShot = [&]()
+            {
+                // Revert to initial state, and advance game state to end of block diff
+                int frameOffset, replayed;
+                if (batch.Enabled()) {
+                    frameOffset = script.ReplayBatchShot(batch, state, m64Diff, &replayed);
+                }
+                else {
+                    tState.LoadTime += state.riskyLoadJ(dll);
+                    frameOffset = replayed = script.DecodeAndExecuteDiff(m64Diff, tState.BaseBlock.tailSeg);
+                }
+                tState.AddFrames(replayed, true);
+                state2.save(dll);
+
+                // Sanity check that state matches saved block state
+                if (!tState.ValidateBaseBlock(script.GetFineStateBin())) {
+                    desynced = true;
+                    return;
+                }
+
+                // "Fire" the scattershot, i.e. execute a batch of semi-random input sequences from the base block state.
+                // With branching, once BranchFanout extensions have left the current origin, the
+                // next one to store a block stops there and the rest of the shot continues from it.
+                // Whether a block is stored depends on the thread's local table, so deterministic
+                // runs do not branch. Refinement shots climb instead: they move on to the first
+                // block they store that beats the one they extend. Beam shots stay on their block.
+                BranchPoint origin = { &state2, tState.BaseBlock, tState.CurrentInput, frameOffset };
+                BranchPoint next = { &state3 };
+                const StrategyOps& strategy = StrategyBases::Strategies[tState.ShotStrategy];
+                bool climbing = strategy.climbs;
+                bool branching = !config.Deterministic && (climbing || (strategy.fansOut && config.BranchFanout > 0));
+                int siblings = 0;
+                for (int subLoop = 0; subLoop < config.SegmentsPerShot; subLoop++) {
+                    tState.LoadTime += origin.state->riskyLoadJ(dll);
+
+                    tState.BaseBlock = origin.block;
+                    tState.CurrentInput = origin.input;
+
+                    uint64_t baseRngSeed = tState.RngSeed;
+                    int megaRandom = Utils::xoro_r(&tState.RngSeed) % 2;
+                    bool canBranch = branching && (climbing || siblings++ >= config.BranchFanout) && subLoop + 1 < config.SegmentsPerShot;
+                    float branchValue = climbing ? origin.block.value : -FLT_MAX;
+                    if (script.ExtendTasFromBlock(m64Diff, origin.frameOffset, megaRandom, baseRngSeed, origin.block.pos, canBranch ? &next : NULL, branchValue)) {
+                        SaveState* spare = origin.state;
+                        origin = next;
+                        next.state = spare;
+                        siblings = 0;
+                        tState.LogBranch();
+                    }
+                }
+            };
+
+        unsigned long faultCode = 0;
+        if (!Utils::TryRun(fireShot, dll.hdll, dll.imageSize, &faultCode) || desynced) {
+            tState.LogFailure();
+            if (desynced) {
+                gState.Desyncs++;
+            }
+            else {
+                gState.Faults++;
+                printer.printfQ("Thread %d: emulator fault 0x%08lx in a shot from block %d %d %d %llu\n", tState.Id, faultCode,
+                    tState.BaseBlock.pos.x, tState.BaseBlock.pos.y, tState.BaseBlock.pos.z, (unsigned long long)tState.BaseBlock.pos.s);
+                if (++emu.consecutiveFaults >= config.RestartAfterFaults) {
+                    sm64_init();
+                    emu.consecutiveFaults = 0;
+                    gState.Restarts++;
+                }
+            }
+            Restore(dll);
+            batch.Invalidate();
+        }
+        else {
+            emu.consecutiveFaults = 0;
+        }
+    }
 }
 
 void main(int argc, char* argv[])
@@ -28,74 +327,211 @@ void main(int argc, char* argv[])
 
     Configuration config;
     InitConfiguration(config);
-    GlobalState gState = GlobalState(config, printer);
+    printer.Start(config.TotalThreads);
+    Memory::Init(config.TotalThreads);
+    if (!Memory::SetLargePagePolicy(config.LargePages, printer))
+        return;
+    Memory::ReportPlacement(printer);
+
+    SearchTarget targets[MaxTargets];
+    int nTargets = InitTargets(config, targets);
+    bool needState3 = false;
+    for (int n = 0; n < nTargets; n++) {
+        SearchTarget& target = targets[n];
+        target.gState = new GlobalState(target.config, printer, n, nTargets > 1 ? target.Name : NULL);
+        needState3 |= target.config.BranchFanout > 0 || target.config.Strategy != STRATEGY_SCATTERSHOT;
+
+        char archivePath[256] = { 0 };
+        sprintf(archivePath, "%s_results.m64a", target.gState->OutputName);
+        target.gState->Results.Start(target.M64Path, target.config.StartFrame, target.config.ResultArchive ? archivePath : NULL);
+
+        // Read inputs from file once for all threads
+        int nFileInputs = 0;
+        target.FileInputs = Utils::GetM64(target.M64Path, &nFileInputs);
+        if (!target.FileInputs || nFileInputs < target.config.StartFrame + 5) {
+            printf("m64 has %d inputs, need at least %d!\n", nFileInputs, target.config.StartFrame + 5);
+            return;
+        }
+    }
+
+    // Published by the thread that advances to the start frame
+    SaveState* startState = NULL;
+    SaveState* advancedState = NULL;
+    Dll* startDll = NULL;
+    Input startInput;
+    Vec3d startBin;
+    bool rebaseValid = true;
+    int activeTarget = 0;
 
     Utils::MultiThread(config.TotalThreads, [&]()
         {
             //--- BEGIN BOILERPLATE ---
-            
+
+            // Pin first, so that the DLL instance and everything below is first touched on this thread's node.
+            if (!Memory::PinCurrentThread(omp_get_thread_num()))
+                printer.printfQ("Thread %d: could not pin to processor, running unpinned\n", omp_get_thread_num());
             //TODO: Maybe don't hardcode DLLs
             LPCWSTR dlls[4] = { L"sm64_jp_0.dll", L"sm64_jp_1.dll" , L"sm64_jp_2.dll" , L"sm64_jp_3.dll" };
-            ThreadState tState = ThreadState(config, gState, omp_get_thread_num());
-            Dll dll = Dll(dlls[tState.Id]);
-            Script script(config, gState, tState, dll);
+            Dll dll = Dll(dlls[omp_get_thread_num()]);
+            TargetThread* threads[MaxTargets];
+            for (int n = 0; n < nTargets; n++)
+                threads[n] = new TargetThread(targets[n], omp_get_thread_num(), dll);
 
-            SaveState state, state2;
-            state.allocState(dll);
+            SaveState state2, state3;
             state2.allocState(dll);
-            Input* m64Diff = (Input*)malloc(sizeof(Input) * (config.SegmentLength * config.MaxSegments + 256)); // Todo: Nasty
+            if (needState3)
+                state3.allocState(dll);
+            Emulator emu = { &dll, &state2, &state3, 0 };
 
             // Initialize game
             VOIDFUNC sm64_init = (VOIDFUNC)GetProcAddress(dll.hdll, "sm64_init");
             sm64_init();
 
-            // Read inputs from file and advance to start frame
-            Input* fileInputs = Utils::GetM64("C:\\Users\\Tyler\\Documents\\repos\\scattershot\\x64\\Debug\\4_units_from_edge.m64");
-            script.AdvanceToStart(state, fileInputs);
-            tState.LoadTime += state.riskyLoadJ(dll);
+            // Each target advances from power-on along its own m64.
+            SaveState powerOn;
+            if (nTargets > 1) {
+                powerOn.allocState(dll);
+                powerOn.save(dll);
+            }
 
-            // Initialize script
-            script.Initialize(script.GetStateBin());
+            for (int n = 0; n < nTargets; n++) {
+                TargetThread& tt = *threads[n];
+                ThreadState& tState = tt.tState;
+                SaveState& state = tt.state;
+                SaveState& advanced = tt.advanced;
 
-            //--- END BOILERPLATE ---
+                // Advance a single instance to the start frame, then install its state into every
+                // other instance instead of emulating the same frames once per thread.
+                Utils::SingleThread([&]()
+                    {
+                        double timerStart = omp_get_wtime();
+                        if (n > 0)
+                            powerOn.load(dll);
+                        else
+                            StickSolver::Init(dll);
+                        tt.script.AdvanceToStart(state, targets[n].FileInputs);
+                        advanced.save(dll);
+                        state.riskyLoadJ(dll);
+                        startBin = tt.script.GetStateBin();
+                        startState = &state;
+                        advancedState = &advanced;
+                        startDll = &dll;
+                        startInput = tState.CurrentInput;
+                        printer.printfQ("Advanced %s to start frame in %.3f s\n", targets[n].Name, omp_get_wtime() - timerStart);
+                        if (n == 0)
+                            printer.printfQ("Stick solver hits %d of 65536 yaws exactly\n", StickSolver::ExactYaws);
+                    });
 
-            for (int mainIteration = 0; mainIteration <= config.MaxShots; mainIteration++) {
-                // ALWAYS START WITH A MERGE SO THE SHARED BLOCKS ARE OK.
-                if (mainIteration % config.ShotsPerMerge == 0)
-                    Utils::SingleThread([&]()
-                        { 
-                            gState.MergeState(mainIteration);
-                            tState.PrintStatus(mainIteration);
-                        });
+                // Once, a second instance advances for real and checks the rebased copy against
+                // its own state byte for byte. Any pointer the rebase missed or data it took for
+                // one shows up here, and then every instance advances itself for the whole run.
+                bool selfAdvanced = startDll == &dll;
+                if (n == 0 && config.TotalThreads > 1) {
+                    #pragma omp barrier
+                    if (omp_get_thread_num() == 1) {
+                        SaveState rebasedStart, rebasedAdvanced;
+                        rebasedStart.allocState(dll);
+                        rebasedAdvanced.allocState(dll);
+                        rebasedStart.copyRebased(*startState, *startDll, dll);
+                        rebasedAdvanced.copyRebased(*advancedState, *startDll, dll);
 
-                // Pick a block to "fire a scattershot" at
-                if (!tState.SelectBaseBlock(mainIteration))
-                    break;
+                        tt.script.AdvanceToStart(state, targets[n].FileInputs);
+                        advanced.save(dll);
+                        selfAdvanced = true;
+                        rebaseValid = memcmp(rebasedStart.data, state.data, dll.dataLength) == 0
+                            && memcmp(rebasedStart.bss, state.bss, dll.bssLength) == 0
+                            && memcmp(rebasedAdvanced.data, advanced.data, dll.dataLength) == 0
+                            && memcmp(rebasedAdvanced.bss, advanced.bss, dll.bssLength) == 0;
+                        if (!rebaseValid)
+                            printer.printfQ("Rebased start state differs from a real advance, every thread advances itself\n");
 
-                // Revert to initial state, and advance game state to end of block diff
+                        rebasedStart.freeState();
+                        rebasedAdvanced.freeState();
+                    }
+                    #pragma omp barrier
+                }
+
+                if (!selfAdvanced && rebaseValid) {
+                    advanced.copyRebased(*advancedState, *startDll, dll);
+                    advanced.load(dll);
+                    state.copyRebased(*startState, *startDll, dll);
+                    tState.CurrentInput = startInput;
+                }
+                else if (!selfAdvanced) {
+                    if (n > 0)
+                        powerOn.load(dll);
+                    tt.script.AdvanceToStart(state, targets[n].FileInputs);
+                    advanced.save(dll);
+                }
                 tState.LoadTime += state.riskyLoadJ(dll);
-                tState.LightningLengthLocal = 0;
-                tState.LightningLocal[tState.LightningLengthLocal++] = script.GetStateBin();
-                int frameOffset = script.DecodeAndExecuteDiff(m64Diff);
-                state2.save(dll);
 
-                // Sanity check that state matches saved block state
-                if (!tState.ValidateBaseBlock(script.GetStateBin()))
-                    return;
+                // Fall back to a full advance if the snapshot did not carry over to this instance
+                if (!tt.script.GetStateBin().truncEq(startBin)) {
+                    printer.printfQ("Thread %d: start state mismatch, advancing from scratch\n", tState.Id);
+                    if (n > 0)
+                        powerOn.load(dll);
+                    tt.script.AdvanceToStart(state, targets[n].FileInputs);
+                    advanced.save(dll);
+                    tState.LoadTime += state.riskyLoadJ(dll);
+                }
 
-                // "Fire" the scattershot, i.e. execute a batch of semi-random input sequences from the base block state.
-                Input origLastIn = tState.CurrentInput;
-                int origLightLenLocal = tState.LightningLengthLocal;
-                for (int subLoop = 0; subLoop < config.SegmentsPerShot; subLoop++) {
-                    tState.LoadTime += state2.riskyLoadJ(dll);
+                // Initialize script
+                tt.script.Initialize(tt.script.GetStateBin());
+            }
 
-                    tState.CurrentInput = origLastIn;
-                    tState.LightningLengthLocal = origLightLenLocal;
+            Utils::SingleThread([&]()
+                {
+                    for (int n = 0; n < nTargets; n++) {
+                        free(targets[n].FileInputs);
+                        targets[n].FileInputs = NULL;
+                    }
+                });
+            if (nTargets > 1)
+                powerOn.freeState();
 
-                    uint64_t baseRngSeed = tState.RngSeed;
-                    int megaRandom = Utils::xoro_r(&tState.RngSeed) % 2;
-                    script.ExtendTasFromBlock(m64Diff, frameOffset, megaRandom, baseRngSeed, tState.BaseBlock.pos);
-                }
+            //--- END BOILERPLATE ---
+
+            // Whole epochs go to one target at a time, merge included, so that the merges
+            // keep every thread on the same target. Targets' memory differs outside the ranges
+            // shots reload, so switching restores the new target's advanced state first.
+            int current = activeTarget;
+            if (nTargets > 1)
+                threads[current]->Resume(dll);
+            while (current >= 0) {
+                TargetThread& tt = *threads[current];
+                double epochStart = omp_get_wtime();
+                // A thread that runs out leaves its epoch early, while the others finish theirs.
+                if (!tt.RunEpoch(emu, nTargets))
+                    tt.target.Exhausted = true;
+
+                Utils::SingleThread([&]()
+                    {
+                        tt.target.UsedTime += omp_get_wtime() - epochStart;
+                        tt.target.Finished = tt.target.Exhausted;
+                        activeTarget = PickTarget(targets, nTargets);
+                        if (nTargets > 1 && activeTarget != current && activeTarget >= 0)
+                            targets[activeTarget].gState->Tuning.Resume();
+                    });
+                // Read after the barrier, so every thread exports or none does.
+                if (tt.target.Finished && tt.config.TopK > 0)
+                    tt.script.ExportTopBlocks(tt.advanced, tt.state, tt.m64Diff);
+                if (activeTarget != current && activeTarget >= 0)
+                    threads[activeTarget]->Resume(dll);
+                current = activeTarget;
             }
+
+            for (int n = 0; n < nTargets; n++)
+                delete threads[n];
         });
+
+    if (nTargets > 1) {
+        double totalTime = 0;
+        for (int n = 0; n < nTargets; n++)
+            totalTime += targets[n].UsedTime;
+        for (int n = 0; n < nTargets; n++)
+            printer.printfQ("TARGET %s share %d, %.1f s (%.1f%%), %d merges, %lld shots\n", targets[n].Name, targets[n].Share,
+                targets[n].UsedTime, totalTime > 0 ? 100.0 * targets[n].UsedTime / totalTime : 0.0, targets[n].gState->MergeCount, targets[n].gState->TotalShots);
+    }
+    for (int n = 0; n < nTargets; n++)
+        delete targets[n].gState;
 }